@@ -1,726 +1,7440 @@
-#include <glad/glad.h>
-#include <GLFW/glfw3.h>
-
-#include <iostream>
-#include <fstream>
-#include <string>
-#include <vector>
-
-#include <glm/glm.hpp>
-#include <glm/gtc/matrix_transform.hpp>
-#include <glm/gtc/type_ptr.hpp>
-
-void createSphere(float radius, int sectorCount, int stackCount,
-    std::vector<float>& vertices,
-    std::vector<unsigned int>& indices)
-{
-    vertices.clear();
-    indices.clear();
-    float x, y, z, xy;                           // vertex position
-    float nx, ny, nz, lengthInv = 1.0f / radius; // normals (optional)
-    float s, t;                                  // texture coords (optional)
-    float sectorStep = 2 * 3.1415 / sectorCount;
-    float stackStep = 3.1415 / stackCount;
-    float sectorAngle, stackAngle;
-
-    for (int i = 0; i <= stackCount; ++i)
-    {
-        stackAngle = 3.1415 / 2 - i * stackStep;   // from pi/2 to -pi/2
-        xy = radius * cosf(stackAngle);
-        z = radius * sinf(stackAngle);
-
-        for (int j = 0; j <= sectorCount; ++j)
-        {
-            sectorAngle = j * sectorStep;
-
-            x = xy * cosf(sectorAngle);
-            y = xy * sinf(sectorAngle);
-            vertices.push_back(x);
-            vertices.push_back(y);
-            vertices.push_back(z);
-
-            // optional color (random or fixed)
-            vertices.push_back(1.0f);
-            vertices.push_back(1.0f);
-            vertices.push_back(0.0f);
-        }
-    }
-
-    int k1, k2;
-    for (int i = 0; i < stackCount; ++i)
-    {
-        k1 = i * (sectorCount + 1);
-        k2 = k1 + sectorCount + 1;
-
-        for (int j = 0; j < sectorCount; ++j, ++k1, ++k2)
-        {
-            if (i != 0)
-            {
-                indices.push_back(k1);
-                indices.push_back(k2);
-                indices.push_back(k1 + 1);
-            }
-            if (i != (stackCount - 1))
-            {
-                indices.push_back(k1 + 1);
-                indices.push_back(k2);
-                indices.push_back(k2 + 1);
-            }
-        }
-    }
-}
-
-
-void framebuffer_size_callback(GLFWwindow* window, int width, int height)
-{
-    glViewport(0, 0, width, height);
-}
-
-// Function to capture screen
-void dump_framebuffer_to_ppm(std::string prefix, unsigned int width, unsigned int height) {
-    int pixelChannel = 3;
-    int totalPixelSize = pixelChannel * width * height * sizeof(GLubyte);
-    GLubyte* pixels = new GLubyte[totalPixelSize];
-    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
-    std::string file_name = prefix + ".ppm";
-    std::ofstream fout(file_name);
-    fout << "P3\n" << width << " " << height << "\n" << 255 << std::endl;
-    for (size_t i = 0; i < height; i++)
-    {
-        for (size_t j = 0; j < width; j++)
-        {
-            size_t cur = pixelChannel * ((height - i - 1) * width + j);
-            fout << (int)pixels[cur] << " " << (int)pixels[cur + 1] << " " << (int)pixels[cur + 2] << " ";
-        }
-        fout << std::endl;
-    }
-    delete[] pixels;
-    fout.flush();
-    fout.close();
-}
-
-int cameraPosition = 1;
-
-// Interactive keys
-void processInput(GLFWwindow* window)
-{
-    // Escape to exit
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, true);
-
-    // Number keys to change camera position
-    /*
-    // Used for task 1
-    if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS)
-    {
-        cameraPosition = 1;
-        std::cout << "Camera Position 1 (2, 7, 3)" << std::endl;
-    }
-
-    if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS)
-    {
-        cameraPosition = 2;
-        std::cout << "Camera Position 2 (-3, -3, -3)" << std::endl;
-    }
-    */
-
-    /*
-    // Used for task 2
-    if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS)
-    {
-        cameraPosition = 1;
-        std::cout << "Camera Position 1 (0, 0, 120)" << std::endl;
-    }
-
-    if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS)
-    {
-        cameraPosition = 2;
-        std::cout << "Camera Position 2 (0, 218, 1)" << std::endl;
-    }
-
-    if (glfwGetKey(window, GLFW_KEY_3) == GLFW_PRESS)
-    {
-        cameraPosition = 3;
-        std::cout << "Camera Position 3 (-180, 70, 20)" << std::endl;
-    }
-
-    if (glfwGetKey(window, GLFW_KEY_4) == GLFW_PRESS)
-    {
-        cameraPosition = 4;
-        std::cout << "Camera Position 4 (-120, 100, 80)," << std::endl;
-    }
-
-    if (glfwGetKey(window, GLFW_KEY_5) == GLFW_PRESS)
-    {
-        cameraPosition = 5;
-        std::cout << "Camera Position 5 (70, 80, 90)" << std::endl;
-    }
-    */
-
-    // Used for task 4
-    if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS)
-    {
-        cameraPosition = 1;
-        std::cout << "Looking at the Sun" << std::endl;
-    }
-    if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS)
-    {
-        cameraPosition = 2;
-        std::cout << "Looking at the Earth" << std::endl;
-    }
-    if (glfwGetKey(window, GLFW_KEY_3) == GLFW_PRESS)
-    {
-        cameraPosition = 3;
-        std::cout << "Looking at the Moon" << std::endl;
-    }
-
-    // P to capture screen
-    /*
-    // Used to capture screen for task 1
-    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
-    {
-        std::cout << "Capture Window " << std::endl;
-        int buffer_width, buffer_height;
-        glfwGetFramebufferSize(window, &buffer_width, &buffer_height);
-        if (cameraPosition == 1)
-            dump_framebuffer_to_ppm("oct1.ppm", buffer_width, buffer_height);
-        else
-            dump_framebuffer_to_ppm("oct2.ppm", buffer_width, buffer_height);
-    }
-    */
-
-    /*
-    // Used to capture screen for task 2
-    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
-    {
-        std::cout << "Capture Window " << std::endl;
-        int buffer_width, buffer_height;
-        glfwGetFramebufferSize(window, &buffer_width, &buffer_height);
-        if (cameraPosition == 1)
-            dump_framebuffer_to_ppm("static_front.ppm", buffer_width, buffer_height);
-        else if (cameraPosition == 2)
-            dump_framebuffer_to_ppm("static_top.ppm", buffer_width, buffer_height);
-        else if (cameraPosition == 3)
-            dump_framebuffer_to_ppm("static_left.ppm", buffer_width, buffer_height);
-        else if (cameraPosition == 4)
-            dump_framebuffer_to_ppm("static_sun.ppm", buffer_width, buffer_height);
-        else if (cameraPosition == 5)
-            dump_framebuffer_to_ppm("static_moon.ppm", buffer_width, buffer_height);
-    }
-    */
-
-    /*
-    // Used to capture screen for task 3
-    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
-    {
-        std::cout << "Capture Window " << std::endl;
-        int buffer_width, buffer_height;
-        glfwGetFramebufferSize(window, &buffer_width, &buffer_height);
-        dump_framebuffer_to_ppm("rotate_d365_earth.ppm", buffer_width, buffer_height); // Name manually changed for corresponding screenshot in task 3
-
-    }
-    */
-    
-}
-
-// Used for task 2
-// Create octahedrons
-void generateOctahedronData(float size,
-    std::vector<float>& vertices,
-    std::vector<unsigned int>& indices) {
-    float h = size * 0.5f;
-
-    glm::vec3 A(-h, 0, 0), B(0, 0, h), C(h, 0, 0),
-        D(0, 0, -h), E(0, h, 0), F(0, -h, 0);
-
-    // Colours
-    glm::vec3 RED(1, 0, 0), GREEN(0, 1, 0), BLUE(0, 0, 1), GREY(0.5f, 0.5f, 0.5f);
-    glm::vec3 FUCHSIA(1, 0, 1), YELLOW(1, 1, 0), AQUA(0, 1, 1), WHITE(1, 1, 1);
-
-    struct Face { glm::vec3 p0, p1, p2, color; };
-    std::vector<Face> faces = {
-        {A,B,E, RED},     // ABE
-        {B,C,E, GREEN},   // BCE
-        {C,D,E, BLUE},    // CDE
-        {D,A,E, GREY},    // DAE
-        {B,A,F, FUCHSIA}, // BAF
-        {C,B,F, YELLOW},  // CBF
-        {D,C,F, AQUA},    // DCF
-        {A,D,F, WHITE}    // ADF
-    };
-
-    vertices.clear(); indices.clear();
-    unsigned int idx = 0;
-    for (auto& f : faces) {
-        glm::vec3 ps[3] = { f.p0,f.p1,f.p2 };
-        for (int i = 0; i < 3; ++i) {
-            vertices.push_back(ps[i].x);
-            vertices.push_back(ps[i].y);
-            vertices.push_back(ps[i].z);
-            vertices.push_back(f.color.r);
-            vertices.push_back(f.color.g);
-            vertices.push_back(f.color.b);
-            indices.push_back(idx++);
-        }
-    }
-}
-
-// Rotation angle functions
-float day = 0.0f;
-// Sun
-float get_sun_rotate_angle_around_itself(float day) {
-    return (360.0f / 27.0f) * day;
-}
-
-// Earth
-float get_earth_rotate_angle_around_sun(float day) {
-    return (360.0f / 365.0f) * day;
-}
-
-float get_earth_rotate_angle_around_itself(float day) {
-    return 360.0f * day;
-}
-
-// Moon
-float get_moon_rotate_angle_around_earth(float day) {
-    return (360.0f / 28.0f) * day;
-}
-
-float get_moon_rotate_angle_around_itself(float day) {
-    return (360.0f / 28.0f) * day;
-}
-
-// Shader
-const char* vertexShaderSource = R"(
-    #version 330 core
-    layout (location = 0) in vec3 aPos;
-    layout (location = 1) in vec3 aColor;
-
-    out vec3 vertexColor;
-
-    uniform mat4 model;
-    uniform mat4 view;
-    uniform mat4 projection;
-
-    void main(){
-       gl_Position = projection * view * model * vec4(aPos, 1.0);
-       vertexColor = aColor;
-     }
-
-)";
-
-const char* fragmentShaderSource = R"(
-    #version 330 core 
-    out vec4 FragColor;
-    in vec3 vertexColor;
-
-    void main(){
-        FragColor = vec4(vertexColor, 1.0);
-    }
-)";
-
-
-
-int main()
-{
-    // Instantiate the GLFW window
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    //glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-
-    // Create window object
-    GLFWwindow* window = glfwCreateWindow(1024, 576, "Assignment 1", NULL, NULL);
-    if (window == NULL)
-    {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
-    }
-
-    glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-
-    // Initalize GLAD
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
-    {
-        std::cout << "Failed to initialize GLAD" << std::endl;
-        return -1;
-    }
-
-    // Compiling and linking shaders
-    unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-    glCompileShader(vertexShader);
-
-    unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-    glCompileShader(fragmentShader);
-
-    unsigned int shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-
-    // Face culling and depth testing
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS); 
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
-    glFrontFace(GL_CCW);
-
-    /*
-    // Used for task 1
-    // Octahedron geomertry
-    float vertices[] = {
-        // Top half
-        -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 0.0f,    // Face ABE
-        0.0f,  0.0f,  1.0f,  1.0f, 0.0f, 0.0f,
-        0.0f,  1.0f,  0.0f,  1.0f, 0.0f, 0.0f,
-
-        0.0f,  0.0f,  1.0f,  0.0f, 1.0f, 0.0f,    // Face BCE 
-        1.0f,  0.0f,  0.0f,  0.0f, 1.0f, 0.0f,
-        0.0f,  1.0f,  0.0f,  0.0f, 1.0f, 0.0f,
-
-        1.0f,  0.0f,  0.0f,  0.0f, 0.0f, 1.0f,    // Face CDE
-        0.0f,  0.0f, -1.0f,  0.0f, 0.0f, 1.0f,
-        0.0f,  1.0f,  0.0f,  0.0f, 0.0f, 1.0f,
-
-        0.0f,  0.0f, -1.0f,  0.5f, 0.5f, 0.5f,    // Face DAE
-       -1.0f,  0.0f,  0.0f,  0.5f, 0.5f, 0.5f,
-        0.0f,  1.0f,  0.0f,  0.5f, 0.5f, 0.5f,
-
-        // Bottom half
-        0.0f,  0.0f,  1.0f,  1.0f, 0.0f, 1.0f,    // Face BAF
-       -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 1.0f,
-        0.0f, -1.0f,  0.0f,  1.0f, 0.0f, 1.0f,
-
-        1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 0.0f,    // Face CBF
-        0.0f,  0.0f,  1.0f,  1.0f, 1.0f, 0.0f,
-        0.0f, -1.0f,  0.0f,  1.0f, 1.0f, 0.0f,
-
-        0.0f,  0.0f, -1.0f,  0.0f, 1.0f, 1.0f,    // Face DCF
-        1.0f,  0.0f,  0.0f,  0.0f, 1.0f, 1.0f,
-        0.0f, -1.0f,  0.0f,  0.0f, 1.0f, 1.0f,
-
-       -1.0f, -0.0f,  0.0f,  1.0f, 1.0f, 1.0f,    // Face ADF
-        0.0f,  0.0f, -1.0f,  1.0f, 1.0f, 1.0f,
-        0.0f, -1.0f,  0.0f,  1.0f, 1.0f, 1.0f
-    };
-
-    unsigned int indices[] = {
-    0, 1, 2,
-    3, 4, 5,
-    6, 7, 8,
-    9,10,11,
-    12,13,14,
-    15,16,17,
-    18,19,20,
-    21,22,23
-    };
-    */
-    
-    // Generate Sun, Moon, and Earth
-    std::vector<float> vertices_sun, vertices_earth, vertices_moon;
-    std::vector<unsigned int> indices_sun, indices_earth, indices_moon;
-
-    generateOctahedronData(18.0f, vertices_sun, indices_sun);
-    generateOctahedronData(10.0f, vertices_earth, indices_earth);
-    generateOctahedronData(6.0f, vertices_moon, indices_moon);
-
-    // Make circlce
-    std::vector<float> vertices_sphere;
-    std::vector<unsigned int> indices_sphere;
-    createSphere(10.0f, 36, 18, vertices_sphere, indices_sphere);
-
-   
-    /*
-    // Used for task 1
-    unsigned int VBO, VAO, EBO;
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
-
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    */
-
-    // Circle for fun
-    unsigned int VAO_sphere, VBO_sphere, EBO_sphere;
-    glGenVertexArrays(1, &VAO_sphere);
-    glGenBuffers(1, &VBO_sphere);
-    glGenBuffers(1, &EBO_sphere);
-
-    glBindVertexArray(VAO_sphere);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO_sphere);
-    glBufferData(GL_ARRAY_BUFFER, vertices_sphere.size() * sizeof(float), vertices_sphere.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO_sphere);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices_sphere.size() * sizeof(unsigned int), indices_sphere.data(), GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    
-    // Used for task 2, 3, & 4
-    unsigned int VAO_sun, VBO_sun, EBO_sun;
-    glGenVertexArrays(1, &VAO_sun);
-    glGenBuffers(1, &VBO_sun);
-    glGenBuffers(1, &EBO_sun);
-
-    glBindVertexArray(VAO_sun);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO_sun);
-    glBufferData(GL_ARRAY_BUFFER, vertices_sun.size() * sizeof(float), vertices_sun.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO_sun);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices_sun.size() * sizeof(unsigned int), indices_sun.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    unsigned int VAO_earth, VBO_earth, EBO_earth;
-    glGenVertexArrays(1, &VAO_earth);
-    glGenBuffers(1, &VBO_earth);
-    glGenBuffers(1, &EBO_earth);
-
-    glBindVertexArray(VAO_earth);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO_earth);
-    glBufferData(GL_ARRAY_BUFFER, vertices_earth.size() * sizeof(float), vertices_earth.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO_earth);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices_earth.size() * sizeof(unsigned int), indices_earth.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    unsigned int VAO_moon, VBO_moon, EBO_moon;
-    glGenVertexArrays(1, &VAO_moon);
-    glGenBuffers(1, &VBO_moon);
-    glGenBuffers(1, &EBO_moon);
-
-    glBindVertexArray(VAO_moon);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO_moon);
-    glBufferData(GL_ARRAY_BUFFER, vertices_moon.size() * sizeof(float), vertices_moon.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO_moon);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices_moon.size() * sizeof(unsigned int), indices_moon.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    glEnable(GL_DEPTH_TEST);
-    glClearColor(0.3f, 0.4f, 0.5f, 1.0f); // Background colour
-
-    float day = 0, inc = 1.0f / 96;
-    while (!glfwWindowShouldClose(window))
-    {
-        processInput(window);
-
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glUseProgram(shaderProgram);
-
-        day += inc;
-
-        // Camera positions / projection
-        /*
-        // Used for task 1
-        glm::mat4 view;
-        if (cameraPosition == 1)
-            view = glm::lookAt(glm::vec3(2.0f, 7.0f, 3.0f),
-                glm::vec3(0.0f, 0.0f, 0.0f),
-                glm::vec3(0.0f, 1.0f, 0.0f));
-        else
-            view = glm::lookAt(glm::vec3(-3.0f, -3.0f, -3.0f),
-                glm::vec3(0.0f, 0.0f, 0.0f),
-                glm::vec3(0.0f, 1.0f, 0.0f));
-        */
-
-        /*
-        // Used for task 2
-        glm::mat4 view;
-        if (cameraPosition == 1)
-            view = glm::lookAt(glm::vec3(0.0f, 0.0f, 120.0f),
-                glm::vec3(0.0f, 0.0f, 0.0f),
-                glm::vec3(0.0f, 1.0f, 0.0f));
-        else if (cameraPosition == 2)
-            view = glm::lookAt(glm::vec3(0.0f, 218.0f, 1.0f),
-                glm::vec3(0.0f, 0.0f, 0.0f),
-                glm::vec3(0.0f, 1.0f, 0.0f));
-        else if (cameraPosition == 3)
-            view = glm::lookAt(glm::vec3(-180.0f, 70.0f, 20.0f),
-                glm::vec3(0.0f, 0.0f, 0.0f),
-                glm::vec3(0.0f, 1.0f, 0.0f));
-        else if (cameraPosition == 4)
-            view = glm::lookAt(glm::vec3(-120.0f, 100.0f, 80.0f),
-                glm::vec3(0.0f, 0.0f, 0.0f),
-                glm::vec3(0.0f, 1.0f, 0.0f));
-        else if (cameraPosition == 5)
-            view = glm::lookAt(glm::vec3(70.0f, 80.0f, 90.0f),
-                glm::vec3(45.0f, 0.0f, 0.0f),
-                glm::vec3(0.0f, 1.0f, 0.0f));
-        */
-
-        /*
-        // Used for task 3
-        glm::mat4 view = glm::lookAt(glm::vec3(60.0f, 30.0f, 80.0f),
-            glm::vec3(30.0f, 0.0f, 0.0f), // Manually changed to look at either the earth's center or sun's center
-            glm::vec3(0.0f, 1.0f, 0.0f));
-        */
-
-        // Calculate Earth and Moon rotations 
-        // Used for task 4
-        glm::mat4 rotate_earth_around_sun = glm::rotate(glm::mat4(1.0f),
-            glm::radians(get_earth_rotate_angle_around_sun(day)),
-            glm::vec3(0.0f, 1.0f, 0.0f));
-        glm::vec3 earthPos = glm::vec3(rotate_earth_around_sun * glm::vec4(30.0f, 0.0f, 0.0f, 1.0f));
-
-        glm::mat4 rotate_moon_around_earth = glm::rotate(glm::mat4(1.0f),
-            glm::radians(get_moon_rotate_angle_around_earth(day)),
-            glm::vec3(0.0f, 1.0f, 0.0f));
-        glm::vec4 moonLocal = rotate_moon_around_earth * glm::vec4(15.0f, 0.0f, 0.0f, 1.0f);
-        glm::vec3 moonPos = glm::vec3(rotate_earth_around_sun * (glm::vec4(30.0f, 0.0f, 0.0f, 1.0f) + moonLocal));
-
-        glm::vec3 cameraWorldPos(30.0f, 20.0f, 90.0f); 
-        glm::vec3 lookTarget(0.0f, 0.0f, 0.0f);
-         
-        if (cameraPosition == 1) {
-            lookTarget = glm::vec3(0.0f, 0.0f, 0.0f); 
-        }
-        else if (cameraPosition == 2) {
-            lookTarget = earthPos; 
-        }
-        else if (cameraPosition == 3) {
-            lookTarget = moonPos;  
-        }
-
-        glm::mat4 view = glm::lookAt(cameraWorldPos, lookTarget, glm::vec3(0.0f, 1.0f, 0.0f));
-        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
-
-        //glm::mat4 model = glm::mat4(1.0f); // Used for task 1
-
-        unsigned int modelLoc = glGetUniformLocation(shaderProgram, "model");
-        unsigned int viewLoc = glGetUniformLocation(shaderProgram, "view");
-        unsigned int projLoc = glGetUniformLocation(shaderProgram, "projection");
-
-        /*
-        // Used for task 1
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model)); 
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view)); 
-        glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection)); 
-        glBindVertexArray(VAO); 
-        glDrawElements(GL_TRIANGLES, 24, GL_UNSIGNED_INT, 0);
-        */
-
-        /*
-        // Used for task 2
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-        // Sun
-        glBindVertexArray(VAO_sun);
-        glm::mat4 model = glm::mat4(1.0f);
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-        glDrawElements(GL_TRIANGLES, indices_sun.size(), GL_UNSIGNED_INT, 0);
-
-        // Earth
-        glBindVertexArray(VAO_earth);
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(30.0f, 0.0f, 0.0f));
-        model = glm::rotate(model, glm::radians(23.4f), glm::vec3(0.0f, 0.0f, 1.0f));
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-        glDrawElements(GL_TRIANGLES, indices_earth.size(), GL_UNSIGNED_INT, 0);
-
-        // Moon
-        glBindVertexArray(VAO_moon);
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(45.0f, 0.0f, 0.0f));
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-        glDrawElements(GL_TRIANGLES, indices_moon.size(), GL_UNSIGNED_INT, 0);
-        */
-
-        
-        // Used for task 3
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-        // Sun
-        glBindVertexArray(VAO_sun);
-        glm::mat4 model_sun = glm::mat4(1.0f);
-        model_sun = glm::rotate(model_sun, glm::radians(get_sun_rotate_angle_around_itself(day)), glm::vec3(0.0f, 1.0f, 0.0f));
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model_sun));
-        glDrawElements(GL_TRIANGLES, indices_sun.size(), GL_UNSIGNED_INT, 0);
-
-        // Earth
-        glBindVertexArray(VAO_earth);
-        glm::mat4 model_earth = glm::mat4(1.0f);
-        model_earth = glm::rotate(model_earth, glm::radians(get_earth_rotate_angle_around_sun(day)), glm::vec3(0.0f, 1.0f, 0.0f));
-        model_earth = glm::translate(model_earth, glm::vec3(30.0f, 0.0f, 0.0f));
-        model_earth = glm::rotate(model_earth, glm::radians(23.4f), glm::vec3(0.0f, 0.0f, 1.0f));
-        model_earth = glm::rotate(model_earth, glm::radians(get_earth_rotate_angle_around_itself(day)), glm::vec3(0.0f, 1.0f, 0.0f));
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model_earth));
-        glDrawElements(GL_TRIANGLES, indices_earth.size(), GL_UNSIGNED_INT, 0);
-
-        // Moon
-        glBindVertexArray(VAO_moon);
-        glm::mat4 model_moon = glm::mat4(1.0f);
-        model_moon = glm::rotate(model_moon, glm::radians(get_earth_rotate_angle_around_sun(day)), glm::vec3(0.0f, 1.0f, 0.0f));
-        model_moon = glm::translate(model_moon, glm::vec3(30.0f, 0.0f, 0.0f));
-        model_moon = glm::rotate(model_moon, glm::radians(get_moon_rotate_angle_around_earth(day)), glm::vec3(0.0f, 1.0f, 0.0f));
-        model_moon = glm::translate(model_moon, glm::vec3(15.0f, 0.0f, 0.0f)); 
-        model_moon = glm::rotate(model_moon, glm::radians(get_moon_rotate_angle_around_itself(day)), glm::vec3(0.0f, 1.0f, 0.0f));
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model_moon));
-        glDrawElements(GL_TRIANGLES, indices_moon.size(), GL_UNSIGNED_INT, 0);
-
-        // Circle for fun
-        /*
-        glBindVertexArray(VAO_sphere);
-        glm::mat4 model_circle = glm::mat4(1.0f);
-        model_circle = glm::translate(model_circle, glm::vec3(20.0f, 20.0f, 0.0f)); // center position
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model_circle));
-        glDrawElements(GL_TRIANGLES, indices_sphere.size(), GL_UNSIGNED_INT, 0);
-        */
-        
-        glfwSwapBuffers(window);
-        glfwPollEvents();
-    }
-
-    // Releasing resources 
-    /*
-    // Used for task 1
-    glDeleteVertexArrays(1, &VAO); 
-    glDeleteBuffers(1, &VBO); 
-    glDeleteBuffers(1, &EBO); 
-    glDeleteProgram(shaderProgram);
-    */
-
-    // Used for task 2, 3, & 4
-    glDeleteVertexArrays(1, &VAO_sun);
-    glDeleteVertexArrays(1, &VAO_earth);
-    glDeleteVertexArrays(1, &VAO_moon);
-    glDeleteBuffers(1, &VBO_sun);
-    glDeleteBuffers(1, &VBO_earth);
-    glDeleteBuffers(1, &VBO_moon);
-    glDeleteBuffers(1, &EBO_sun);
-    glDeleteBuffers(1, &EBO_earth);
-    glDeleteBuffers(1, &EBO_moon);
-    glDeleteProgram(shaderProgram);
-   
-    glfwTerminate();
-
-    return 0;
-}
-
-
-
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#ifdef __linux__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
+#include <cstddef>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <random>
+#include <unordered_map>
+#include <charconv>
+
+#include <cstdint>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <csignal>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/constants.hpp>
+
+void createSphere(float radius, int sectorCount, int stackCount,
+    std::vector<float>& vertices,
+    std::vector<unsigned int>& indices)
+{
+    vertices.clear();
+    indices.clear();
+    vertices.reserve((size_t)(stackCount + 1) * (sectorCount + 1) * 6);
+    indices.reserve((size_t)6 * sectorCount * (stackCount - 1));
+    const float PI = glm::pi<float>();
+    float x, y, z, xy;                           // vertex position
+    float nx, ny, nz, lengthInv = 1.0f / radius; // normals (optional)
+    float s, t;                                  // texture coords (optional)
+    float sectorStep = 2 * PI / sectorCount;
+    float stackStep = PI / stackCount;
+    float sectorAngle, stackAngle;
+
+    for (int i = 0; i <= stackCount; ++i)
+    {
+        stackAngle = PI / 2 - i * stackStep;   // from pi/2 to -pi/2
+        xy = radius * cosf(stackAngle);
+        z = radius * sinf(stackAngle);
+
+        for (int j = 0; j <= sectorCount; ++j)
+        {
+            sectorAngle = j * sectorStep;
+
+            x = xy * cosf(sectorAngle);
+            y = xy * sinf(sectorAngle);
+            vertices.push_back(x);
+            vertices.push_back(y);
+            vertices.push_back(z);
+
+            // optional color (random or fixed)
+            vertices.push_back(1.0f);
+            vertices.push_back(1.0f);
+            vertices.push_back(0.0f);
+        }
+    }
+
+    int k1, k2;
+    for (int i = 0; i < stackCount; ++i)
+    {
+        k1 = i * (sectorCount + 1);
+        k2 = k1 + sectorCount + 1;
+
+        for (int j = 0; j < sectorCount; ++j, ++k1, ++k2)
+        {
+            if (i != 0)
+            {
+                indices.push_back(k1);
+                indices.push_back(k2);
+                indices.push_back(k1 + 1);
+            }
+            if (i != (stackCount - 1))
+            {
+                indices.push_back(k1 + 1);
+                indices.push_back(k2);
+                indices.push_back(k2 + 1);
+            }
+        }
+    }
+}
+
+// Icosphere: an icosahedron whose triangles are split in four per subdivision and pushed back
+// onto the sphere. Level n has 20 * 4^n triangles and 10 * 4^n + 2 vertices, both reserved up front.
+void createIcosphere(float radius, int subdivisions,
+    std::vector<float>& vertices,
+    std::vector<unsigned int>& indices)
+{
+    size_t faceCount = (size_t)20 << (2 * subdivisions);
+    size_t vertexCount = faceCount / 2 + 2;
+    vertices.clear();
+    indices.clear();
+    vertices.reserve(vertexCount * 6);
+    indices.reserve(faceCount * 3);
+
+    std::vector<glm::vec3> points;
+    points.reserve(vertexCount);
+    const float t = (1.0f + sqrtf(5.0f)) / 2.0f;
+    const float corners[12][3] = {
+        {-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0},
+        {0, -1, t}, {0, 1, t}, {0, -1, -t}, {0, 1, -t},
+        {t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1}
+    };
+    for (auto& c : corners)
+        points.push_back(glm::normalize(glm::vec3(c[0], c[1], c[2])));
+
+    const unsigned int faces[20][3] = {
+        {0, 11, 5}, {0, 5, 1}, {0, 1, 7}, {0, 7, 10}, {0, 10, 11},
+        {1, 5, 9}, {5, 11, 4}, {11, 10, 2}, {10, 7, 6}, {7, 1, 8},
+        {3, 9, 4}, {3, 4, 2}, {3, 2, 6}, {3, 6, 8}, {3, 8, 9},
+        {4, 9, 5}, {2, 4, 11}, {6, 2, 10}, {8, 6, 7}, {9, 8, 1}
+    };
+    for (auto& f : faces)
+        indices.insert(indices.end(), f, f + 3);
+
+    // Each edge is split once, shared by the two triangles on either side of it
+    std::unordered_map<uint64_t, unsigned int> midpoints;
+    std::vector<unsigned int> next;
+    for (int level = 0; level < subdivisions; ++level)
+    {
+        midpoints.clear();
+        midpoints.reserve(indices.size());
+        next.clear();
+        next.reserve(indices.size() * 4);
+        auto midpoint = [&](unsigned int a, unsigned int b) {
+            uint64_t key = a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+            auto found = midpoints.find(key);
+            if (found != midpoints.end())
+                return found->second;
+            unsigned int index = (unsigned int)points.size();
+            points.push_back(glm::normalize(points[a] + points[b]));
+            midpoints.emplace(key, index);
+            return index;
+        };
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            unsigned int a = indices[i], b = indices[i + 1], c = indices[i + 2];
+            unsigned int ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+            unsigned int split[12] = { a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca };
+            next.insert(next.end(), split, split + 12);
+        }
+        indices.swap(next);
+    }
+
+    for (const glm::vec3& p : points)
+    {
+        vertices.push_back(p.x * radius);
+        vertices.push_back(p.y * radius);
+        vertices.push_back(p.z * radius);
+
+        vertices.push_back(1.0f);
+        vertices.push_back(1.0f);
+        vertices.push_back(0.0f);
+    }
+}
+
+
+void framebuffer_size_callback(GLFWwindow* window, int width, int height)
+{
+    glViewport(0, 0, width, height);
+}
+
+// Profiler
+// Scoped CPU zones and a GL_TIME_ELAPSED query around the scene pass, recorded per frame when
+// --profile is given. Rolling frame time percentiles are kept either way. GPU results are read
+// from a small ring of queries a few frames late, only once they are available, so profiling
+// never stalls the pipeline. At exit everything is written as a Chrome trace (chrome://tracing,
+// Perfetto) and a per-frame CSV. Zone times are inclusive.
+enum ProfileZone { ZONE_FRAME, ZONE_SIMULATION, ZONE_TRANSFORMS, ZONE_CULLING, ZONE_UPLOAD, ZONE_DRAW, ZONE_CAPTURE, ZONE_COUNT };
+
+const char* PROFILE_ZONE_NAMES[ZONE_COUNT] = { "frame", "simulation", "transforms", "culling", "upload", "draw", "capture" };
+const int GPU_QUERY_RING = 4;
+const size_t ROLLING_FRAMES = 240;
+
+struct TraceEvent
+{
+    int zone;           // ZONE_COUNT for the GPU pass
+    long long frame;
+    double startUs, durationUs;
+};
+
+struct FrameTimes
+{
+    double zoneMs[ZONE_COUNT];
+    double gpuMs;       // negative until the query result arrives
+};
+
+struct GpuQuery
+{
+    unsigned int query = 0;
+    long long frame = -1;
+    double submitUs = 0.0;
+};
+
+struct Profiler
+{
+    bool enabled = false;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    long long frame = -1;
+    double frameStartUs = 0.0;
+    std::vector<TraceEvent> events;
+    std::vector<FrameTimes> frames;
+    GpuQuery gpuQueries[GPU_QUERY_RING];
+    int gpuHead = 0;
+    bool gpuActive = false;
+    std::deque<double> rolling; // recent frame times in ms
+};
+
+Profiler profiler;
+
+double profilerNowUs()
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - profiler.origin).count();
+}
+
+// Records a zone from construction to destruction
+struct ProfileScope
+{
+    int zone;
+    double startUs;
+
+    explicit ProfileScope(ProfileZone z) : zone(z), startUs(profiler.enabled ? profilerNowUs() : 0.0) {}
+    ~ProfileScope()
+    {
+        if (!profiler.enabled || profiler.frame < 0)
+            return;
+        double durationUs = profilerNowUs() - startUs;
+        profiler.events.push_back({ zone, profiler.frame, startUs, durationUs });
+        profiler.frames.back().zoneMs[zone] += durationUs / 1000.0;
+    }
+};
+
+double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+        return 0.0;
+    size_t k = std::min(values.size() - 1, (size_t)(p * (values.size() - 1) + 0.5));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+void startProfiler()
+{
+    profiler = Profiler();
+    profiler.enabled = true;
+    profiler.origin = std::chrono::steady_clock::now();
+    for (GpuQuery& gpu : profiler.gpuQueries)
+        glGenQueries(1, &gpu.query);
+}
+
+// Collects every finished GPU query; with wait set, also the ones still in flight
+void resolveGpuQueries(bool wait)
+{
+    for (int i = 0; i < GPU_QUERY_RING; ++i)
+    {
+        GpuQuery& gpu = profiler.gpuQueries[(profiler.gpuHead + i) % GPU_QUERY_RING];
+        if (gpu.frame < 0)
+            continue;
+        int available = 0;
+        glGetQueryObjectiv(gpu.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available && !wait)
+            continue;
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64v(gpu.query, GL_QUERY_RESULT, &elapsedNs);
+        double durationUs = elapsedNs / 1000.0;
+        // The pass cannot have taken longer than it has been since it was submitted; some drivers
+        // (llvmpipe) report nonsense for a query object's first use
+        if (durationUs <= profilerNowUs() - gpu.submitUs)
+        {
+            profiler.frames[gpu.frame].gpuMs = durationUs / 1000.0;
+            profiler.events.push_back({ ZONE_COUNT, gpu.frame, gpu.submitUs, durationUs });
+        }
+        gpu.frame = -1;
+    }
+}
+
+void beginProfileFrame()
+{
+    profiler.frameStartUs = profilerNowUs();
+    if (!profiler.enabled)
+        return;
+    resolveGpuQueries(false);
+    profiler.frame = (long long)profiler.frames.size();
+    FrameTimes times = {};
+    times.gpuMs = -1.0;
+    profiler.frames.push_back(times);
+}
+
+void endProfileFrame()
+{
+    double durationUs = profilerNowUs() - profiler.frameStartUs;
+    profiler.rolling.push_back(durationUs / 1000.0);
+    if (profiler.rolling.size() > ROLLING_FRAMES)
+        profiler.rolling.pop_front();
+    if (!profiler.enabled || profiler.frame < 0)
+        return;
+    profiler.events.push_back({ ZONE_FRAME, profiler.frame, profiler.frameStartUs, durationUs });
+    profiler.frames.back().zoneMs[ZONE_FRAME] = durationUs / 1000.0;
+}
+
+// Brackets the scene pass with a timer query. If the ring slot is still waiting on an old result
+// the pass goes untimed rather than blocking.
+void beginGpuPass()
+{
+    if (!profiler.enabled || profiler.frame < 0)
+        return;
+    GpuQuery& gpu = profiler.gpuQueries[profiler.gpuHead];
+    if (gpu.frame >= 0)
+        return;
+    gpu.frame = profiler.frame;
+    gpu.submitUs = profilerNowUs();
+    glBeginQuery(GL_TIME_ELAPSED, gpu.query);
+    profiler.gpuActive = true;
+}
+
+void endGpuPass()
+{
+    if (!profiler.gpuActive)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    profiler.gpuActive = false;
+    profiler.gpuHead = (profiler.gpuHead + 1) % GPU_QUERY_RING;
+}
+
+// p50 / p95 / p99 of the recent frame times
+std::string rollingFrameSummary()
+{
+    std::vector<double> recent(profiler.rolling.begin(), profiler.rolling.end());
+    char text[128];
+    std::snprintf(text, sizeof(text), "frame ms p50 %.2f  p95 %.2f  p99 %.2f",
+        percentile(recent, 0.5), percentile(recent, 0.95), percentile(recent, 0.99));
+    return text;
+}
+
+// Writes PREFIX.json (Chrome trace events) and PREFIX.csv (one row per frame), then frees the queries
+bool finishProfiler(const std::string& prefix)
+{
+    if (!profiler.enabled)
+        return true;
+    resolveGpuQueries(true);
+    for (GpuQuery& gpu : profiler.gpuQueries)
+        glDeleteQueries(1, &gpu.query);
+    profiler.enabled = false;
+
+    std::ofstream trace(prefix + ".json");
+    trace << "{\"traceEvents\":[\n";
+    trace << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+    trace << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+    char line[192];
+    for (const TraceEvent& event : profiler.events)
+    {
+        bool gpu = event.zone == ZONE_COUNT;
+        std::snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%lld}}",
+            gpu ? "scene pass" : PROFILE_ZONE_NAMES[event.zone], gpu ? 2 : 1, event.startUs, event.durationUs, event.frame);
+        trace << line;
+    }
+    trace << "\n]}\n";
+
+    std::ofstream csv(prefix + ".csv");
+    csv << "frame";
+    for (int zone = 0; zone < ZONE_COUNT; ++zone)
+        csv << "," << PROFILE_ZONE_NAMES[zone] << "_ms";
+    csv << ",gpu_ms\n";
+    for (size_t frame = 0; frame < profiler.frames.size(); ++frame)
+    {
+        const FrameTimes& times = profiler.frames[frame];
+        csv << frame;
+        for (int zone = 0; zone < ZONE_COUNT; ++zone)
+            csv << "," << times.zoneMs[zone];
+        csv << ",";
+        if (times.gpuMs >= 0.0)
+            csv << times.gpuMs;
+        csv << "\n";
+    }
+
+    std::vector<double> frameMs;
+    for (const FrameTimes& times : profiler.frames)
+        frameMs.push_back(times.zoneMs[ZONE_FRAME]);
+    std::cout << "Profile: " << profiler.frames.size() << " frames, frame ms p50 " << percentile(frameMs, 0.5)
+        << " p95 " << percentile(frameMs, 0.95) << " p99 " << percentile(frameMs, 0.99)
+        << ", written to " << prefix << ".json and " << prefix << ".csv" << std::endl;
+    if (!trace.good() || !csv.good())
+    {
+        std::cout << "Failed writing the profile to " << prefix << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Job system
+// A fixed pool of workers, each with its own deque of jobs. A worker takes its newest job first
+// (still warm in cache) and, when it runs dry, steals the oldest job of another queue, which is
+// usually the largest piece left. Threads outside the pool share one more queue. A thread waiting
+// on a job runs other jobs meanwhile, so jobs can submit and wait on jobs of their own.
+struct Job;
+typedef std::shared_ptr<Job> JobHandle;
+
+struct Job
+{
+    std::function<void()> work;
+    std::atomic<int> blockers{ 1 };   // unfinished dependencies, plus one until submitJob is done
+    std::atomic<bool> done{ false };
+    std::mutex lock;                  // guards dependents and the move to done
+    std::vector<JobHandle> dependents;
+};
+
+struct JobQueue
+{
+    std::mutex lock;
+    std::deque<JobHandle> jobs;
+};
+
+struct JobSystem
+{
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<JobQueue>> queues; // one per worker, the last for outside threads
+    std::atomic<bool> running{ false };
+    std::atomic<int> queued{ 0 };
+    std::mutex sleepLock;
+    std::condition_variable wake;
+
+    ~JobSystem();
+};
+
+JobSystem jobSystem;
+thread_local int jobWorkerIndex = -1; // this thread's queue in the pool, -1 outside it
+
+// Threads that run jobs: the workers plus the thread waiting on them
+size_t jobThreadCount()
+{
+    return jobSystem.workers.size() + 1;
+}
+
+void pushJob(const JobHandle& job)
+{
+    JobSystem& jobs = jobSystem;
+    size_t index = jobWorkerIndex >= 0 ? (size_t)jobWorkerIndex : jobs.queues.size() - 1;
+    {
+        std::lock_guard<std::mutex> guard(jobs.queues[index]->lock);
+        jobs.queues[index]->jobs.push_back(job);
+    }
+    jobs.queued.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> guard(jobs.sleepLock); // no wakeup lost between check and wait
+    }
+    jobs.wake.notify_one();
+}
+
+void releaseJob(const JobHandle& job)
+{
+    if (job->blockers.fetch_sub(1) == 1)
+        pushJob(job);
+}
+
+// Pops from the own queue's back, otherwise steals from the front of the others
+JobHandle takeJob()
+{
+    JobSystem& jobs = jobSystem;
+    size_t count = jobs.queues.size();
+    size_t own = jobWorkerIndex >= 0 ? (size_t)jobWorkerIndex : count - 1;
+    for (size_t k = 0; k < count; ++k)
+    {
+        JobQueue& queue = *jobs.queues[(own + k) % count];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.jobs.empty())
+            continue;
+        JobHandle job;
+        if (k == 0)
+        {
+            job = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+        }
+        else
+        {
+            job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+        }
+        jobs.queued.fetch_sub(1);
+        return job;
+    }
+    return nullptr;
+}
+
+bool runOneJob()
+{
+    JobHandle job = takeJob();
+    if (!job)
+        return false;
+    job->work();
+    std::vector<JobHandle> dependents;
+    {
+        std::lock_guard<std::mutex> guard(job->lock);
+        job->done.store(true, std::memory_order_release);
+        dependents.swap(job->dependents);
+    }
+    for (const JobHandle& dependent : dependents)
+        releaseJob(dependent);
+    return true;
+}
+
+void jobWorkerLoop(int index)
+{
+    jobWorkerIndex = index;
+    JobSystem& jobs = jobSystem;
+    while (jobs.running.load())
+    {
+        if (runOneJob())
+            continue;
+        std::unique_lock<std::mutex> sleep(jobs.sleepLock);
+        jobs.wake.wait(sleep, [&] { return jobs.queued.load() > 0 || !jobs.running.load(); });
+    }
+}
+
+// Queues work to run once every job in dependencies has finished
+JobHandle submitJob(std::function<void()> work, const std::vector<JobHandle>& dependencies = {})
+{
+    JobHandle job = std::make_shared<Job>();
+    job->work = std::move(work);
+    for (const JobHandle& dependency : dependencies)
+    {
+        std::lock_guard<std::mutex> guard(dependency->lock);
+        if (dependency->done.load(std::memory_order_acquire))
+            continue;
+        job->blockers.fetch_add(1);
+        dependency->dependents.push_back(job);
+    }
+    releaseJob(job);
+    return job;
+}
+
+void waitForJob(const JobHandle& job)
+{
+    while (!job->done.load(std::memory_order_acquire))
+    {
+        if (!runOneJob())
+            std::this_thread::yield();
+    }
+}
+
+void stopJobSystem()
+{
+    JobSystem& jobs = jobSystem;
+    if (!jobs.running.exchange(false))
+        return;
+    {
+        std::lock_guard<std::mutex> guard(jobs.sleepLock);
+    }
+    jobs.wake.notify_all();
+    for (std::thread& worker : jobs.workers)
+        worker.join();
+    jobs.workers.clear();
+}
+
+JobSystem::~JobSystem()
+{
+    stopJobSystem();
+}
+
+// threads counts the calling thread too, 0 means one per hardware thread
+void startJobSystem(size_t threads)
+{
+    stopJobSystem();
+    JobSystem& jobs = jobSystem;
+    if (threads == 0)
+        threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    jobs.queues.clear();
+    for (size_t i = 0; i < threads; ++i)
+        jobs.queues.emplace_back(new JobQueue());
+    jobs.queued.store(0);
+    jobs.running.store(true);
+    for (size_t i = 0; i + 1 < threads; ++i)
+        jobs.workers.emplace_back(jobWorkerLoop, (int)i);
+}
+
+// Runs body(begin, end) over [0, count) in about four jobs per thread, never smaller than minPerJob,
+// so stealing can even out chunks that take longer than others. The caller runs the first chunk.
+template <typename Body>
+void parallelFor(size_t count, size_t minPerJob, Body body)
+{
+    size_t jobs = std::min(jobThreadCount() * 4, count / std::max<size_t>(1, minPerJob));
+    if (jobThreadCount() <= 1 || jobs <= 1)
+    {
+        body((size_t)0, count);
+        return;
+    }
+
+    size_t chunk = (count + jobs - 1) / jobs;
+    std::vector<JobHandle> handles;
+    for (size_t begin = chunk; begin < count; begin += chunk)
+    {
+        size_t end = std::min(count, begin + chunk);
+        handles.push_back(submitJob([&body, begin, end] { body(begin, end); }));
+    }
+    body((size_t)0, std::min(count, chunk));
+    for (const JobHandle& handle : handles)
+        waitForJob(handle);
+}
+
+// Frame encoders
+// Pixels come in as bottom-up RGBA rows straight from glReadPixels and are written top-down RGB
+enum class CaptureFormat { PPM, QOI };
+
+const char* captureExtension(CaptureFormat format)
+{
+    return format == CaptureFormat::QOI ? ".qoi" : ".ppm";
+}
+
+// Bottom-up RGBA to top-down RGB, rows split across jobs
+void flipRowsToRGB(const unsigned char* rgba, int width, int height, unsigned char* rgb)
+{
+    parallelFor((size_t)height, 64, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            const unsigned char* row = rgba + (height - i - 1) * width * 4;
+            unsigned char* out = rgb + i * width * 3;
+            for (int j = 0; j < width; j++, out += 3)
+            {
+                out[0] = row[4 * j];
+                out[1] = row[4 * j + 1];
+                out[2] = row[4 * j + 2];
+            }
+        }
+    });
+}
+
+// Binary P6, one write for the whole image
+bool writePPM(const std::string& file_name, const unsigned char* rgba, int width, int height,
+    std::vector<unsigned char>& scratch)
+{
+    char header[32];
+    int headerSize = std::snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    scratch.resize(headerSize + (size_t)width * height * 3);
+    std::memcpy(scratch.data(), header, headerSize);
+
+    flipRowsToRGB(rgba, width, height, scratch.data() + headerSize);
+
+    std::ofstream fout(file_name, std::ios::binary);
+    fout.write((const char*)scratch.data(), scratch.size());
+    return (bool)fout;
+}
+
+// QOI (https://qoiformat.org), lossless and usually a third of the P6 size.
+// Encodes into scratch and returns the byte count. The colour index holds alpha too and starts
+// zeroed like a decoder's, so an index hit on a colour never written (black) decodes the same.
+size_t encodeQOI(const unsigned char* rgba, int width, int height, std::vector<unsigned char>& scratch)
+{
+    scratch.resize(14 + (size_t)width * height * 4 + 8);
+    unsigned char* out = scratch.data();
+    auto put32 = [&](unsigned int v) {
+        *out++ = (unsigned char)(v >> 24); *out++ = (unsigned char)(v >> 16);
+        *out++ = (unsigned char)(v >> 8); *out++ = (unsigned char)v;
+    };
+    *out++ = 'q'; *out++ = 'o'; *out++ = 'i'; *out++ = 'f';
+    put32(width);
+    put32(height);
+    *out++ = 3; // RGB
+    *out++ = 0; // sRGB
+
+    unsigned char index[64][4] = {};
+    unsigned char pr = 0, pg = 0, pb = 0;
+    int run = 0;
+    for (int i = 0; i < height; i++)
+    {
+        const unsigned char* row = rgba + (size_t)(height - i - 1) * width * 4;
+        for (int j = 0; j < width; j++)
+        {
+            unsigned char r = row[4 * j], g = row[4 * j + 1], b = row[4 * j + 2];
+            if (r == pr && g == pg && b == pb)
+            {
+                if (++run == 62)
+                {
+                    *out++ = 0xc0 | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0)
+            {
+                *out++ = 0xc0 | (run - 1);
+                run = 0;
+            }
+
+            int hash = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+            if (index[hash][0] == r && index[hash][1] == g && index[hash][2] == b && index[hash][3] == 255)
+                *out++ = (unsigned char)hash;
+            else
+            {
+                index[hash][0] = r; index[hash][1] = g; index[hash][2] = b; index[hash][3] = 255;
+                signed char vr = (signed char)(r - pr), vg = (signed char)(g - pg), vb = (signed char)(b - pb);
+                int vg_r = vr - vg, vg_b = vb - vg;
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+                    *out++ = 0x40 | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8)
+                {
+                    *out++ = 0x80 | (vg + 32);
+                    *out++ = (unsigned char)((vg_r + 8) << 4 | (vg_b + 8));
+                }
+                else
+                {
+                    *out++ = 0xfe; *out++ = r; *out++ = g; *out++ = b;
+                }
+            }
+            pr = r; pg = g; pb = b;
+        }
+    }
+    if (run > 0)
+        *out++ = 0xc0 | (run - 1);
+    for (int i = 0; i < 7; i++)
+        *out++ = 0;
+    *out++ = 1;
+    return out - scratch.data();
+}
+
+bool writeQOI(const std::string& file_name, const unsigned char* rgba, int width, int height,
+    std::vector<unsigned char>& scratch)
+{
+    size_t size = encodeQOI(rgba, width, height, scratch);
+    std::ofstream fout(file_name, std::ios::binary);
+    fout.write((const char*)scratch.data(), size);
+    return (bool)fout;
+}
+
+// Reference decoder following the spec, to RGBA rows from the top. Returns false on a
+// malformed or truncated stream.
+bool decodeQOI(const unsigned char* data, size_t size, std::vector<unsigned char>& rgba, int& width, int& height)
+{
+    if (size < 22 || std::memcmp(data, "qoif", 4) != 0)
+        return false;
+    auto get32 = [&](size_t at) { return (unsigned int)data[at] << 24 | data[at + 1] << 16 | data[at + 2] << 8 | data[at + 3]; };
+    width = (int)get32(4);
+    height = (int)get32(8);
+    size_t pixels = (size_t)width * height, end = size - 8, p = 14;
+    rgba.resize(pixels * 4);
+    unsigned char index[64][4] = {};
+    unsigned char px[4] = { 0, 0, 0, 255 };
+    int run = 0;
+    for (size_t i = 0; i < pixels; ++i)
+    {
+        if (run > 0)
+            --run;
+        else
+        {
+            if (p >= end)
+                return false;
+            unsigned char op = data[p++];
+            if (op == 0xfe || op == 0xff)
+            {
+                int channels = op == 0xfe ? 3 : 4;
+                if (end - p < (size_t)channels)
+                    return false;
+                for (int c = 0; c < channels; ++c)
+                    px[c] = data[p++];
+            }
+            else if ((op & 0xc0) == 0x00)
+                std::memcpy(px, index[op], 4);
+            else if ((op & 0xc0) == 0x40)
+            {
+                px[0] += ((op >> 4) & 3) - 2;
+                px[1] += ((op >> 2) & 3) - 2;
+                px[2] += (op & 3) - 2;
+            }
+            else if ((op & 0xc0) == 0x80)
+            {
+                if (p >= end)
+                    return false;
+                int vg = (op & 0x3f) - 32, next = data[p++];
+                px[0] += vg - 8 + (next >> 4);
+                px[1] += vg;
+                px[2] += vg - 8 + (next & 15);
+            }
+            else
+                run = op & 0x3f;
+            int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+            std::memcpy(index[hash], px, 4);
+        }
+        std::memcpy(&rgba[i * 4], px, 4);
+    }
+    return true;
+}
+
+bool writeFrame(CaptureFormat format, const std::string& file_name, const unsigned char* rgba,
+    int width, int height, std::vector<unsigned char>& scratch)
+{
+    if (format == CaptureFormat::QOI)
+        return writeQOI(file_name, rgba, width, height, scratch);
+    return writePPM(file_name, rgba, width, height, scratch);
+}
+
+// Raw frame streaming (stdout or a named pipe, straight into an encoder such as ffmpeg)
+// Each frame is converted directly into one output buffer and written with a single write call.
+// Writes block when the reader is slow, which stalls the writer thread and, through its bounded
+// queue, the render loop.
+// RawRGBA passes frames on exactly as read back, from shard workers to the process encoding them.
+enum class StreamFormat { Y4M, RawRGB, RawRGBA };
+
+// "-" means stdout
+int openFrameStream(const std::string& path)
+{
+#ifdef _WIN32
+    if (path == "-")
+    {
+        _setmode(_fileno(stdout), _O_BINARY);
+        return _fileno(stdout);
+    }
+    int fd = -1;
+    _sopen_s(&fd, path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE);
+    return fd;
+#else
+    // A closed pipe should fail the write, not kill the process
+    std::signal(SIGPIPE, SIG_IGN);
+    if (path == "-")
+        return STDOUT_FILENO;
+    return open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+}
+
+void closeFrameStream(int fd)
+{
+#ifdef _WIN32
+    if (fd >= 0 && fd != _fileno(stdout))
+        _close(fd);
+#else
+    if (fd >= 0 && fd != STDOUT_FILENO)
+        close(fd);
+#endif
+}
+
+bool writeAll(int fd, const unsigned char* data, size_t size)
+{
+    while (size > 0)
+    {
+#ifdef _WIN32
+        int chunk = size > (1u << 30) ? (1 << 30) : (int)size;
+        int written = _write(fd, data, chunk);
+#else
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+#endif
+        if (written <= 0)
+            return false;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Fails on end of file as well as on errors
+bool readAll(int fd, unsigned char* data, size_t size)
+{
+    while (size > 0)
+    {
+#ifdef _WIN32
+        int chunk = size > (1u << 30) ? (1 << 30) : (int)size;
+        int got = _read(fd, data, chunk);
+#else
+        ssize_t got = read(fd, data, size);
+        if (got < 0 && errno == EINTR)
+            continue;
+#endif
+        if (got <= 0)
+            return false;
+        data += got;
+        size -= got;
+    }
+    return true;
+}
+
+// Full range BT.601 (the C420jpeg Y4M colour space) in 8.8 fixed point.
+// The +32895 bias keeps chroma in 0..65535 so the SIMD path can use unsigned 16-bit lanes.
+inline unsigned char rgbToY(int r, int g, int b) { return (unsigned char)((77 * r + 150 * g + 29 * b + 128) >> 8); }
+inline unsigned char rgbToU(int r, int g, int b) { return (unsigned char)((128 * b - 43 * r - 85 * g + 32895) >> 8); }
+inline unsigned char rgbToV(int r, int g, int b) { return (unsigned char)((128 * r - 107 * g - 21 * b + 32895) >> 8); }
+
+// Converts two RGBA rows into two Y rows and one 2x2 subsampled U/V row.
+// row1 may equal row0 for the last row of an odd height image.
+void convertRowPairToYUV420(const unsigned char* row0, const unsigned char* row1, int width,
+    unsigned char* y0, unsigned char* y1, unsigned char* u, unsigned char* v)
+{
+    int x = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128i byteMask = _mm_set1_epi32(0xFF);
+    const __m128i one16 = _mm_set1_epi16(1);
+    auto split = [&](const unsigned char* p, __m128i& r, __m128i& g, __m128i& b) {
+        __m128i lo = _mm_loadu_si128((const __m128i*)p);
+        __m128i hi = _mm_loadu_si128((const __m128i*)(p + 16));
+        r = _mm_packs_epi32(_mm_and_si128(lo, byteMask), _mm_and_si128(hi, byteMask));
+        g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 8), byteMask), _mm_and_si128(_mm_srli_epi32(hi, 8), byteMask));
+        b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 16), byteMask), _mm_and_si128(_mm_srli_epi32(hi, 16), byteMask));
+    };
+    auto luma = [&](__m128i r, __m128i g, __m128i b) {
+        __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(77)), _mm_mullo_epi16(g, _mm_set1_epi16(150))),
+            _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(29)), _mm_set1_epi16(128)));
+        return _mm_packus_epi16(_mm_srli_epi16(sum, 8), _mm_setzero_si128());
+    };
+    // Sum horizontal pairs of a 2 row sum and average, giving 4 values in the low 16-bit lanes
+    auto average2x2 = [&](__m128i top, __m128i bottom) {
+        __m128i pairs = _mm_madd_epi16(_mm_add_epi16(top, bottom), one16);
+        pairs = _mm_srli_epi32(_mm_add_epi32(pairs, _mm_set1_epi32(2)), 2);
+        return _mm_packs_epi32(pairs, _mm_setzero_si128());
+    };
+
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i r0, g0, b0, r1, g1, b1;
+        split(row0 + 4 * x, r0, g0, b0);
+        split(row1 + 4 * x, r1, g1, b1);
+        _mm_storel_epi64((__m128i*)(y0 + x), luma(r0, g0, b0));
+        _mm_storel_epi64((__m128i*)(y1 + x), luma(r1, g1, b1));
+
+        __m128i r = average2x2(r0, r1), g = average2x2(g0, g1), b = average2x2(b0, b1);
+        __m128i bias = _mm_set1_epi16((short)32895);
+        __m128i uSum = _mm_add_epi16(_mm_sub_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(128)),
+            _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(43)), _mm_mullo_epi16(g, _mm_set1_epi16(85)))), bias);
+        __m128i vSum = _mm_add_epi16(_mm_sub_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(128)),
+            _mm_add_epi16(_mm_mullo_epi16(g, _mm_set1_epi16(107)), _mm_mullo_epi16(b, _mm_set1_epi16(21)))), bias);
+        int uBytes = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_srli_epi16(uSum, 8), _mm_setzero_si128()));
+        int vBytes = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_srli_epi16(vSum, 8), _mm_setzero_si128()));
+        std::memcpy(u + x / 2, &uBytes, 4);
+        std::memcpy(v + x / 2, &vBytes, 4);
+    }
+#endif
+    for (; x < width; x += 2)
+    {
+        int x1 = x + 1 < width ? x + 1 : x;
+        const unsigned char* p[4] = { row0 + 4 * x, row0 + 4 * x1, row1 + 4 * x, row1 + 4 * x1 };
+        y0[x] = rgbToY(p[0][0], p[0][1], p[0][2]);
+        y1[x] = rgbToY(p[2][0], p[2][1], p[2][2]);
+        if (x1 != x)
+        {
+            y0[x1] = rgbToY(p[1][0], p[1][1], p[1][2]);
+            y1[x1] = rgbToY(p[3][0], p[3][1], p[3][2]);
+        }
+        int r = (p[0][0] + p[1][0] + p[2][0] + p[3][0] + 2) >> 2;
+        int g = (p[0][1] + p[1][1] + p[2][1] + p[3][1] + 2) >> 2;
+        int b = (p[0][2] + p[1][2] + p[2][2] + p[3][2] + 2) >> 2;
+        u[x / 2] = rgbToU(r, g, b);
+        v[x / 2] = rgbToV(r, g, b);
+    }
+}
+
+// Writes one frame of a stream; the Y4M header goes out with the first frame
+bool writeStreamFrame(int fd, StreamFormat format, int fps, bool& headerWritten, const unsigned char* rgba,
+    int width, int height, std::vector<unsigned char>& scratch)
+{
+    if (format == StreamFormat::RawRGBA)
+        return writeAll(fd, rgba, (size_t)width * height * 4);
+
+    char header[96];
+    int headerSize = 0;
+    if (format == StreamFormat::Y4M && !headerWritten)
+        headerSize = std::snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+    if (format == StreamFormat::Y4M)
+        headerSize += std::snprintf(header + headerSize, sizeof(header) - headerSize, "FRAME\n");
+
+    int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    size_t frameSize = format == StreamFormat::Y4M
+        ? (size_t)width * height + 2 * (size_t)chromaWidth * chromaHeight
+        : (size_t)width * height * 3;
+    scratch.resize(headerSize + frameSize);
+    std::memcpy(scratch.data(), header, headerSize);
+    unsigned char* out = scratch.data() + headerSize;
+
+    if (format == StreamFormat::Y4M)
+    {
+        unsigned char* yPlane = out;
+        unsigned char* uPlane = yPlane + (size_t)width * height;
+        unsigned char* vPlane = uPlane + (size_t)chromaWidth * chromaHeight;
+        parallelFor((size_t)chromaHeight, 32, [&](size_t begin, size_t end) {
+            for (int i = 2 * (int)begin; i < 2 * (int)end; i += 2)
+            {
+                int i1 = i + 1 < height ? i + 1 : i;
+                const unsigned char* row0 = rgba + (size_t)(height - i - 1) * width * 4;
+                const unsigned char* row1 = rgba + (size_t)(height - i1 - 1) * width * 4;
+                convertRowPairToYUV420(row0, row1, width, yPlane + (size_t)i * width, yPlane + (size_t)i1 * width,
+                    uPlane + (size_t)(i / 2) * chromaWidth, vPlane + (size_t)(i / 2) * chromaWidth);
+            }
+        });
+    }
+    else
+        flipRowsToRGB(rgba, width, height, out);
+
+    headerWritten = true;
+    return writeAll(fd, scratch.data(), scratch.size());
+}
+
+// Function to capture screen
+// Blocking, kept for one-off screenshots; use FrameCapture for capturing every frame
+void dump_framebuffer_to_ppm(std::string prefix, unsigned int width, unsigned int height) {
+    std::vector<unsigned char> pixels((size_t)width * height * 4), scratch;
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    writePPM(prefix + ".ppm", pixels.data(), width, height, scratch);
+}
+
+// Background encoder thread
+// Frames are queued with their own pixel buffers, which go back to a free list once written
+struct CapturedFrame
+{
+    std::vector<unsigned char> pixels;
+    int width = 0, height = 0;
+    std::string file_name;
+};
+
+struct FrameWriter
+{
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable queueChanged;
+    std::deque<CapturedFrame> queue;
+    std::vector<std::vector<unsigned char>> freeBuffers;
+    size_t maxQueued = 8;
+    bool stopping = false;
+    CaptureFormat format = CaptureFormat::PPM;
+    long long framesWritten = 0;
+    bool failed = false;
+
+    // Set when frames go to a stream instead of numbered files
+    int streamFd = -1;
+    StreamFormat streamFormat = StreamFormat::Y4M;
+    int streamFps = 30;
+    bool streamHeaderWritten = false;
+};
+
+void frameWriterLoop(FrameWriter& writer)
+{
+    std::vector<unsigned char> scratch;
+    std::unique_lock<std::mutex> lock(writer.mutex);
+    while (true)
+    {
+        writer.queueChanged.wait(lock, [&] { return writer.stopping || !writer.queue.empty(); });
+        if (writer.queue.empty())
+            return;
+
+        CapturedFrame frame = std::move(writer.queue.front());
+        writer.queue.pop_front();
+        writer.queueChanged.notify_all();
+        lock.unlock();
+
+        bool ok;
+        if (writer.streamFd >= 0)
+            ok = !writer.failed && writeStreamFrame(writer.streamFd, writer.streamFormat, writer.streamFps,
+                writer.streamHeaderWritten, frame.pixels.data(), frame.width, frame.height, scratch);
+        else
+            ok = writeFrame(writer.format, frame.file_name, frame.pixels.data(), frame.width, frame.height, scratch);
+
+        lock.lock();
+        if (!ok && !writer.failed)
+        {
+            std::cout << "Failed to write " << (writer.streamFd >= 0 ? "frame stream" : frame.file_name) << std::endl;
+            writer.failed = true;
+        }
+        writer.framesWritten++;
+        writer.freeBuffers.push_back(std::move(frame.pixels));
+    }
+}
+
+void startFrameWriter(FrameWriter& writer, CaptureFormat format)
+{
+    writer.format = format;
+    writer.stopping = false;
+    writer.thread = std::thread(frameWriterLoop, std::ref(writer));
+}
+
+std::vector<unsigned char> acquireFrameBuffer(FrameWriter& writer, size_t size)
+{
+    std::vector<unsigned char> buffer;
+    {
+        std::lock_guard<std::mutex> lock(writer.mutex);
+        if (!writer.freeBuffers.empty())
+        {
+            buffer = std::move(writer.freeBuffers.back());
+            writer.freeBuffers.pop_back();
+        }
+    }
+    buffer.resize(size);
+    return buffer;
+}
+
+// Blocks while the queue is full so a slow disk throttles rendering instead of growing memory
+void submitFrame(FrameWriter& writer, CapturedFrame&& frame)
+{
+    std::unique_lock<std::mutex> lock(writer.mutex);
+    writer.queueChanged.wait(lock, [&] { return writer.queue.size() < writer.maxQueued; });
+    writer.queue.push_back(std::move(frame));
+    writer.queueChanged.notify_all();
+}
+
+bool frameWriterFailed(FrameWriter& writer)
+{
+    std::lock_guard<std::mutex> lock(writer.mutex);
+    return writer.failed;
+}
+
+void stopFrameWriter(FrameWriter& writer)
+{
+    {
+        std::lock_guard<std::mutex> lock(writer.mutex);
+        writer.stopping = true;
+    }
+    writer.queueChanged.notify_all();
+    if (writer.thread.joinable())
+        writer.thread.join();
+}
+
+// Asynchronous framebuffer capture
+// glReadPixels goes into a ring of pixel pack buffers and is only mapped a few frames later,
+// once its fence has signalled, so the CPU never waits for the GPU to finish the frame
+const int CAPTURE_RING_SIZE = 3;
+
+struct PendingReadback
+{
+    unsigned int PBO = 0;
+    GLsync fence = 0;
+    int width = 0, height = 0;
+    std::string file_name;
+};
+
+struct FrameCapture
+{
+    PendingReadback ring[CAPTURE_RING_SIZE];
+    int head = 0;       // next slot to read into
+    int inFlight = 0;   // readbacks waiting on their fence
+    size_t bufferSize = 0;
+    FrameWriter writer;
+};
+
+void startFrameCapture(FrameCapture& capture, CaptureFormat format)
+{
+    for (int i = 0; i < CAPTURE_RING_SIZE; i++)
+        glGenBuffers(1, &capture.ring[i].PBO);
+    startFrameWriter(capture.writer, format);
+}
+
+// Copies the oldest readback out to the writer, returns false if it is not ready and wait is false
+bool resolveOldestReadback(FrameCapture& capture, bool wait)
+{
+    if (capture.inFlight == 0)
+        return false;
+    PendingReadback& slot = capture.ring[(capture.head - capture.inFlight + CAPTURE_RING_SIZE) % CAPTURE_RING_SIZE];
+
+    GLenum status = glClientWaitSync(slot.fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED)
+    {
+        if (!wait)
+            return false;
+        do
+            status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000);
+        while (status == GL_TIMEOUT_EXPIRED);
+    }
+    glDeleteSync(slot.fence);
+    slot.fence = 0;
+
+    size_t size = (size_t)slot.width * slot.height * 4;
+    CapturedFrame frame;
+    frame.pixels = acquireFrameBuffer(capture.writer, size);
+    frame.width = slot.width;
+    frame.height = slot.height;
+    frame.file_name = std::move(slot.file_name);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.PBO);
+    void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (mapped)
+    {
+        std::memcpy(frame.pixels.data(), mapped, size);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    capture.inFlight--;
+
+    if (!mapped)
+    {
+        std::cout << "Failed to map capture buffer for " << frame.file_name << std::endl;
+        return true;
+    }
+    submitFrame(capture.writer, std::move(frame));
+    return true;
+}
+
+// Hands any readbacks whose fence has signalled to the writer without blocking
+void pollFrameCapture(FrameCapture& capture)
+{
+    while (resolveOldestReadback(capture, false))
+        ;
+}
+
+// Queues a readback of the current read framebuffer, the file name gets the format's extension
+void captureFrame(FrameCapture& capture, const std::string& prefix, int width, int height)
+{
+    size_t size = (size_t)width * height * 4;
+    if (size > capture.bufferSize)
+    {
+        while (capture.inFlight > 0)
+            resolveOldestReadback(capture, true);
+        for (int i = 0; i < CAPTURE_RING_SIZE; i++)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.ring[i].PBO);
+            glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        }
+        capture.bufferSize = size;
+    }
+    if (capture.inFlight == CAPTURE_RING_SIZE)
+        resolveOldestReadback(capture, true);
+
+    PendingReadback& slot = capture.ring[capture.head];
+    slot.width = width;
+    slot.height = height;
+    slot.file_name = prefix + captureExtension(capture.writer.format);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.PBO);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    capture.head = (capture.head + 1) % CAPTURE_RING_SIZE;
+    capture.inFlight++;
+}
+
+// Drains every pending readback and waits for the writer to finish
+void finishFrameCapture(FrameCapture& capture)
+{
+    while (capture.inFlight > 0)
+        resolveOldestReadback(capture, true);
+    stopFrameWriter(capture.writer);
+    for (int i = 0; i < CAPTURE_RING_SIZE; i++)
+        glDeleteBuffers(1, &capture.ring[i].PBO);
+    capture.bufferSize = 0;
+}
+
+int cameraPosition = 1;
+int followedAsteroid = -1; // picked with the mouse, -1 to follow cameraPosition
+bool captureRequested = false;
+double warpChange = 1.0; // factor to apply to the time warp, reset once the frame applies it
+
+// Points the camera at a body: 0-2 for the Sun, Earth and Moon, 3 + i for asteroid i
+void followBody(int body)
+{
+    static const char* names[3] = { "Sun", "Earth", "Moon" };
+    followedAsteroid = body >= 3 ? body - 3 : -1;
+    if (body < 3)
+    {
+        cameraPosition = body + 1;
+        std::cout << "Looking at the " << names[body] << std::endl;
+    }
+    else
+        std::cout << "Looking at asteroid " << followedAsteroid << std::endl;
+}
+
+// Interactive keys
+// Keys arrive as events from glfwPollEvents, so each press acts once however long it is held
+void key_callback(GLFWwindow* window, int key, int /*scancode*/, int action, int /*mods*/)
+{
+    // Hold P to capture every frame through the asynchronous capture pipeline
+    if (key == GLFW_KEY_P)
+        captureRequested = action != GLFW_RELEASE;
+    if (action != GLFW_PRESS)
+        return;
+
+    // Escape to exit
+    if (key == GLFW_KEY_ESCAPE)
+        glfwSetWindowShouldClose(window, true);
+
+    // Used for task 4
+    if (key == GLFW_KEY_1)
+        followBody(0);
+    if (key == GLFW_KEY_2)
+        followBody(1);
+    if (key == GLFW_KEY_3)
+        followBody(2);
+
+    // + and - speed time up or slow it down tenfold
+    if (key == GLFW_KEY_EQUAL || key == GLFW_KEY_KP_ADD)
+        warpChange *= 10.0;
+    else if (key == GLFW_KEY_MINUS || key == GLFW_KEY_KP_SUBTRACT)
+        warpChange *= 0.1;
+}
+
+// Used for task 2
+// Create octahedrons
+void generateOctahedronData(float size,
+    std::vector<float>& vertices,
+    std::vector<unsigned int>& indices) {
+    float h = size * 0.5f;
+
+    glm::vec3 A(-h, 0, 0), B(0, 0, h), C(h, 0, 0),
+        D(0, 0, -h), E(0, h, 0), F(0, -h, 0);
+
+    // Colours
+    glm::vec3 RED(1, 0, 0), GREEN(0, 1, 0), BLUE(0, 0, 1), GREY(0.5f, 0.5f, 0.5f);
+    glm::vec3 FUCHSIA(1, 0, 1), YELLOW(1, 1, 0), AQUA(0, 1, 1), WHITE(1, 1, 1);
+
+    struct Face { glm::vec3 p0, p1, p2, color; };
+    std::vector<Face> faces = {
+        {A,B,E, RED},     // ABE
+        {B,C,E, GREEN},   // BCE
+        {C,D,E, BLUE},    // CDE
+        {D,A,E, GREY},    // DAE
+        {B,A,F, FUCHSIA}, // BAF
+        {C,B,F, YELLOW},  // CBF
+        {D,C,F, AQUA},    // DCF
+        {A,D,F, WHITE}    // ADF
+    };
+
+    vertices.clear(); indices.clear();
+    unsigned int idx = 0;
+    for (auto& f : faces) {
+        glm::vec3 ps[3] = { f.p0,f.p1,f.p2 };
+        for (int i = 0; i < 3; ++i) {
+            vertices.push_back(ps[i].x);
+            vertices.push_back(ps[i].y);
+            vertices.push_back(ps[i].z);
+            vertices.push_back(f.color.r);
+            vertices.push_back(f.color.g);
+            vertices.push_back(f.color.b);
+            indices.push_back(idx++);
+        }
+    }
+}
+
+// Scene description
+// Sizes, orbits and periods of the three bodies. They default to the assignment's values and can be
+// overridden by a scene file (see Scene files), which names them by the keys in SCENE_PARAMETERS.
+struct SceneDescription
+{
+    double sunSize = 18.0, earthSize = 10.0, moonSize = 6.0, asteroidSize = 1.0;
+    double earthOrbitRadius = 30.0;  // scene units, also the scale of one AU in N-body mode
+    double moonOrbitRadius = 15.0;
+    double sunRotationDays = 27.0;
+    double earthOrbitDays = 365.0, earthRotationDays = 1.0;
+    double moonOrbitDays = 28.0, moonRotationDays = 28.0;
+    double earthTiltDegrees = 23.4;
+};
+
+SceneDescription scene;
+
+struct SceneParameter
+{
+    const char* name;
+    double SceneDescription::* field;
+    bool positive; // sizes, radii and periods, which are divided by or scale the scene
+};
+
+const SceneParameter SCENE_PARAMETERS[] = {
+    { "sun_size", &SceneDescription::sunSize, true },
+    { "earth_size", &SceneDescription::earthSize, true },
+    { "moon_size", &SceneDescription::moonSize, true },
+    { "asteroid_size", &SceneDescription::asteroidSize, true },
+    { "earth_orbit_radius", &SceneDescription::earthOrbitRadius, true },
+    { "moon_orbit_radius", &SceneDescription::moonOrbitRadius, true },
+    { "sun_rotation_days", &SceneDescription::sunRotationDays, true },
+    { "earth_orbit_days", &SceneDescription::earthOrbitDays, true },
+    { "earth_rotation_days", &SceneDescription::earthRotationDays, true },
+    { "moon_orbit_days", &SceneDescription::moonOrbitDays, true },
+    { "moon_rotation_days", &SceneDescription::moonRotationDays, true },
+    { "earth_tilt_degrees", &SceneDescription::earthTiltDegrees, false },
+};
+const int SCENE_PARAMETER_COUNT = (int)(sizeof(SCENE_PARAMETERS) / sizeof(SCENE_PARAMETERS[0]));
+
+// Rotation angle functions
+// Days are doubles and angles are wrapped to [0, 360) before narrowing, so they stay exact
+// however far the clock has run
+double day = 0.0;
+// Sun
+float get_sun_rotate_angle_around_itself(double day) {
+    return (float)fmod((360.0 / scene.sunRotationDays) * day, 360.0);
+}
+
+// Earth
+float get_earth_rotate_angle_around_sun(double day) {
+    return (float)fmod((360.0 / scene.earthOrbitDays) * day, 360.0);
+}
+
+float get_earth_rotate_angle_around_itself(double day) {
+    return (float)fmod((360.0 / scene.earthRotationDays) * day, 360.0);
+}
+
+// Moon
+float get_moon_rotate_angle_around_earth(double day) {
+    return (float)fmod((360.0 / scene.moonOrbitDays) * day, 360.0);
+}
+
+float get_moon_rotate_angle_around_itself(double day) {
+    return (float)fmod((360.0 / scene.moonRotationDays) * day, 360.0);
+}
+
+// N-body physics
+// Bodies are integrated under mutual gravity in astronomical units, days and solar masses.
+// State is stored as structure-of-arrays doubles so the pairwise force loop vectorises,
+// and the loop over bodies is split across cores once there are enough of them.
+enum class PhysicsMode { Analytic, NBody, Ephemeris, Kepler, Replay };
+enum class Integrator { Leapfrog, Yoshida4 };
+enum class ForceSolver { Direct, BarnesHut };
+
+// Barnes-Hut octree, rebuilt every force evaluation into the same arena.
+// Bodies are sorted by Morton code so every node covers a contiguous range of the sorted copies.
+// Nodes are stored depth first, each with the index just past its subtree, so a traversal is a
+// single forward walk without a stack: descend by moving to n + 1, skip a subtree by jumping to next.
+struct OctreeNode
+{
+    double comX, comY, comZ, mass;  // centre of mass and total mass
+    double size;                    // cell edge length
+    unsigned int begin, end;        // range in the sorted body arrays
+    unsigned int next;              // first node after this subtree
+    unsigned int leaf;
+};
+
+struct Octree
+{
+    std::vector<std::pair<unsigned long long, unsigned int>> keys; // Morton code, body index
+    std::vector<double> x, y, z, mass;                           // bodies in Morton order
+    std::vector<OctreeNode> nodes;
+    std::vector<unsigned int> leaves;
+    std::vector<std::vector<OctreeNode>> subtrees;               // per-octant arenas for the parallel build
+};
+
+const double GAUSSIAN_GRAVITY = 2.9591220828559093e-4; // G in AU^3 / (solar mass * day^2)
+
+struct NBodySystem
+{
+    std::vector<double> x, y, z;
+    std::vector<double> vx, vy, vz;
+    std::vector<double> ax, ay, az;
+    std::vector<double> mass;
+    std::vector<double> px, py, pz; // positions one step back, for interpolation
+    double previousTime = 0.0;
+    double G = GAUSSIAN_GRAVITY;
+    double softening2 = 0.0;  // squared softening length, 0 for exact point masses
+    double time = 0.0;        // days
+    double dt = 1.0 / 24;     // fixed step in days
+    Integrator integrator = Integrator::Yoshida4;
+    bool accelerationValid = false;
+    long long steps = 0;
+
+    ForceSolver solver = ForceSolver::Direct;
+    double theta = 0.5;       // Barnes-Hut opening angle, smaller is more accurate
+    Octree tree;
+};
+
+int addBody(NBodySystem& system, glm::dvec3 position, glm::dvec3 velocity, double mass)
+{
+    system.x.push_back(position.x); system.y.push_back(position.y); system.z.push_back(position.z);
+    system.vx.push_back(velocity.x); system.vy.push_back(velocity.y); system.vz.push_back(velocity.z);
+    system.ax.push_back(0.0); system.ay.push_back(0.0); system.az.push_back(0.0);
+    system.mass.push_back(mass);
+    system.accelerationValid = false;
+    return (int)system.mass.size() - 1;
+}
+
+// Sums m_j * (r_j - r_i) / |r_j - r_i|^3 over n sources (without G). Pairs at zero distance
+// (the body itself) contribute nothing.
+void sumGravity(const double* x, const double* y, const double* z, const double* m, size_t n, double eps2,
+    double xi, double yi, double zi, double& sx, double& sy, double& sz)
+{
+    size_t j = 0;
+#if defined(__AVX512F__)
+    __m512d accX = _mm512_setzero_pd(), accY = _mm512_setzero_pd(), accZ = _mm512_setzero_pd();
+    __m512d pxi = _mm512_set1_pd(xi), pyi = _mm512_set1_pd(yi), pzi = _mm512_set1_pd(zi);
+    __m512d soft = _mm512_set1_pd(eps2), zero = _mm512_setzero_pd(), one = _mm512_set1_pd(1.0);
+    for (; j + 8 <= n; j += 8)
+    {
+        __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(x + j), pxi);
+        __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(y + j), pyi);
+        __m512d dz = _mm512_sub_pd(_mm512_loadu_pd(z + j), pzi);
+        __m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_fmadd_pd(dy, dy, _mm512_fmadd_pd(dz, dz, soft)));
+        __mmask8 valid = _mm512_cmp_pd_mask(r2, zero, _CMP_GT_OQ);
+        __m512d inv = _mm512_maskz_div_pd(valid, one, _mm512_sqrt_pd(r2));
+        __m512d s = _mm512_mul_pd(_mm512_mul_pd(inv, _mm512_mul_pd(inv, inv)), _mm512_loadu_pd(m + j));
+        accX = _mm512_fmadd_pd(dx, s, accX);
+        accY = _mm512_fmadd_pd(dy, s, accY);
+        accZ = _mm512_fmadd_pd(dz, s, accZ);
+    }
+    sx += _mm512_reduce_add_pd(accX);
+    sy += _mm512_reduce_add_pd(accY);
+    sz += _mm512_reduce_add_pd(accZ);
+#elif defined(__AVX2__)
+    __m256d accX = _mm256_setzero_pd(), accY = _mm256_setzero_pd(), accZ = _mm256_setzero_pd();
+    __m256d pxi = _mm256_set1_pd(xi), pyi = _mm256_set1_pd(yi), pzi = _mm256_set1_pd(zi);
+    __m256d soft = _mm256_set1_pd(eps2), zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.0);
+    for (; j + 4 <= n; j += 4)
+    {
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + j), pxi);
+        __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + j), pyi);
+        __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z + j), pzi);
+        __m256d r2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)),
+            _mm256_add_pd(_mm256_mul_pd(dz, dz), soft));
+        __m256d valid = _mm256_cmp_pd(r2, zero, _CMP_GT_OQ);
+        __m256d inv = _mm256_and_pd(_mm256_div_pd(one, _mm256_sqrt_pd(r2)), valid);
+        __m256d s = _mm256_mul_pd(_mm256_mul_pd(inv, _mm256_mul_pd(inv, inv)), _mm256_loadu_pd(m + j));
+        accX = _mm256_add_pd(accX, _mm256_mul_pd(dx, s));
+        accY = _mm256_add_pd(accY, _mm256_mul_pd(dy, s));
+        accZ = _mm256_add_pd(accZ, _mm256_mul_pd(dz, s));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, accX); sx += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm256_storeu_pd(lanes, accY); sy += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm256_storeu_pd(lanes, accZ); sz += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; j < n; ++j)
+    {
+        double dx = x[j] - xi, dy = y[j] - yi, dz = z[j] - zi;
+        double r2 = dx * dx + dy * dy + dz * dz + eps2;
+        if (r2 <= 0.0)
+            continue;
+        double inv = 1.0 / std::sqrt(r2);
+        double s = inv * inv * inv * m[j];
+        sx += dx * s;
+        sy += dy * s;
+        sz += dz * s;
+    }
+}
+
+// Direct summation: accelerations of bodies [begin, end) from every body
+void accumulateAccelerations(NBodySystem& system, size_t begin, size_t end)
+{
+    const size_t n = system.mass.size();
+    for (size_t i = begin; i < end; ++i)
+    {
+        double sx = 0.0, sy = 0.0, sz = 0.0;
+        sumGravity(system.x.data(), system.y.data(), system.z.data(), system.mass.data(), n, system.softening2,
+            system.x[i], system.y[i], system.z[i], sx, sy, sz);
+        system.ax[i] = system.G * sx;
+        system.ay[i] = system.G * sy;
+        system.az[i] = system.G * sz;
+    }
+}
+
+// Barnes-Hut
+const int OCTREE_LEAF_SIZE = 16;
+const int MORTON_BITS = 21;
+
+// Spreads the low 21 bits of v so there are two zero bits between each
+unsigned long long expandMortonBits(unsigned long long v)
+{
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8) & 0x100f00f00f00f00fULL;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2) & 0x1249249249249249ULL;
+    return v;
+}
+
+// Sorts chunks as separate jobs, then merges them pairwise
+template <typename T>
+void parallelSort(std::vector<T>& values)
+{
+    size_t threads = jobThreadCount();
+    size_t chunk = std::max<size_t>(4096, (values.size() + threads - 1) / threads);
+    size_t chunks = (values.size() + chunk - 1) / chunk;
+    parallelFor(chunks, 1, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; ++c)
+            std::sort(values.begin() + c * chunk, values.begin() + std::min(values.size(), (c + 1) * chunk));
+    });
+    for (size_t width = chunk; width < values.size(); width *= 2)
+    {
+        size_t merges = (values.size() + 2 * width - 1) / (2 * width);
+        parallelFor(merges, 1, [&](size_t begin, size_t end) {
+            for (size_t m = begin; m < end; ++m)
+            {
+                size_t first = m * 2 * width, middle = std::min(values.size(), first + width);
+                size_t last = std::min(values.size(), first + 2 * width);
+                std::inplace_merge(values.begin() + first, values.begin() + middle, values.begin() + last);
+            }
+        });
+    }
+}
+
+// Appends the subtree for sorted bodies [begin, end) at the given depth, returns its root index
+unsigned int buildOctreeNode(Octree& tree, std::vector<OctreeNode>& arena, unsigned int begin, unsigned int end,
+    int level, double size)
+{
+    unsigned int index = (unsigned int)arena.size();
+    arena.push_back(OctreeNode());
+    double mass = 0.0, mx = 0.0, my = 0.0, mz = 0.0;
+    bool leaf = end - begin <= (unsigned int)OCTREE_LEAF_SIZE || level == MORTON_BITS;
+
+    if (leaf)
+    {
+        for (unsigned int i = begin; i < end; ++i)
+        {
+            mass += tree.mass[i];
+            mx += tree.mass[i] * tree.x[i];
+            my += tree.mass[i] * tree.y[i];
+            mz += tree.mass[i] * tree.z[i];
+        }
+    }
+    else
+    {
+        int shift = 3 * (MORTON_BITS - 1 - level);
+        unsigned int childBegin = begin;
+        while (childBegin < end)
+        {
+            unsigned long long octant = (tree.keys[childBegin].first >> shift) & 7;
+            unsigned int childEnd = childBegin + 1;
+            while (childEnd < end && ((tree.keys[childEnd].first >> shift) & 7) == octant)
+                ++childEnd;
+            unsigned int child = buildOctreeNode(tree, arena, childBegin, childEnd, level + 1, size * 0.5);
+            mass += arena[child].mass;
+            mx += arena[child].mass * arena[child].comX;
+            my += arena[child].mass * arena[child].comY;
+            mz += arena[child].mass * arena[child].comZ;
+            childBegin = childEnd;
+        }
+    }
+
+    OctreeNode& node = arena[index];
+    node.mass = mass;
+    node.comX = mass > 0.0 ? mx / mass : tree.x[begin];
+    node.comY = mass > 0.0 ? my / mass : tree.y[begin];
+    node.comZ = mass > 0.0 ? mz / mass : tree.z[begin];
+    node.size = size;
+    node.begin = begin;
+    node.end = end;
+    node.leaf = leaf;
+    node.next = (unsigned int)arena.size();
+    return index;
+}
+
+void buildOctree(Octree& tree, const NBodySystem& system)
+{
+    const size_t n = system.mass.size();
+    tree.nodes.clear();
+    if (n == 0)
+        return;
+
+    double minX = system.x[0], minY = system.y[0], minZ = system.z[0];
+    double maxX = minX, maxY = minY, maxZ = minZ;
+    for (size_t i = 1; i < n; ++i)
+    {
+        minX = std::min(minX, system.x[i]); maxX = std::max(maxX, system.x[i]);
+        minY = std::min(minY, system.y[i]); maxY = std::max(maxY, system.y[i]);
+        minZ = std::min(minZ, system.z[i]); maxZ = std::max(maxZ, system.z[i]);
+    }
+    double size = std::max(std::max(maxX - minX, maxY - minY), std::max(maxZ - minZ, 1e-12)) * (1.0 + 1e-9);
+    double scale = (double)(1 << MORTON_BITS) / size;
+
+    tree.keys.resize(n);
+    parallelFor(n, 4096, [&](size_t begin, size_t end) {
+        const unsigned long long maxCell = (1 << MORTON_BITS) - 1;
+        for (size_t i = begin; i < end; ++i)
+        {
+            unsigned long long cx = std::min(maxCell, (unsigned long long)((system.x[i] - minX) * scale));
+            unsigned long long cy = std::min(maxCell, (unsigned long long)((system.y[i] - minY) * scale));
+            unsigned long long cz = std::min(maxCell, (unsigned long long)((system.z[i] - minZ) * scale));
+            tree.keys[i] = { expandMortonBits(cx) << 2 | expandMortonBits(cy) << 1 | expandMortonBits(cz), (unsigned int)i };
+        }
+    });
+    parallelSort(tree.keys);
+
+    tree.x.resize(n); tree.y.resize(n); tree.z.resize(n); tree.mass.resize(n);
+    parallelFor(n, 4096, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k)
+        {
+            unsigned int i = tree.keys[k].second;
+            tree.x[k] = system.x[i];
+            tree.y[k] = system.y[i];
+            tree.z[k] = system.z[i];
+            tree.mass[k] = system.mass[i];
+        }
+    });
+
+    if (n <= (size_t)OCTREE_LEAF_SIZE)
+    {
+        buildOctreeNode(tree, tree.nodes, 0, (unsigned int)n, 0, size);
+        return;
+    }
+
+    // The eight octants of the root are built in parallel into their own arenas, then spliced
+    // after the root with their next indices shifted
+    unsigned int octantBegin[9];
+    int shift = 3 * (MORTON_BITS - 1);
+    for (unsigned int o = 0, k = 0; o <= 8; ++o)
+    {
+        while (k < n && ((tree.keys[k].first >> shift) & 7) < o)
+            ++k;
+        octantBegin[o] = k;
+    }
+    octantBegin[8] = (unsigned int)n;
+
+    tree.subtrees.resize(8);
+    parallelFor(8, 1, [&](size_t begin, size_t end) {
+        for (size_t o = begin; o < end; ++o)
+        {
+            tree.subtrees[o].clear();
+            if (octantBegin[o] < octantBegin[o + 1])
+                buildOctreeNode(tree, tree.subtrees[o], octantBegin[o], octantBegin[o + 1], 1, size * 0.5);
+        }
+    });
+
+    tree.nodes.push_back(OctreeNode());
+    double mass = 0.0, mx = 0.0, my = 0.0, mz = 0.0;
+    for (int o = 0; o < 8; ++o)
+    {
+        unsigned int offset = (unsigned int)tree.nodes.size();
+        for (OctreeNode node : tree.subtrees[o])
+        {
+            node.next += offset;
+            tree.nodes.push_back(node);
+        }
+        if (!tree.subtrees[o].empty())
+        {
+            const OctreeNode& child = tree.subtrees[o][0];
+            mass += child.mass;
+            mx += child.mass * child.comX;
+            my += child.mass * child.comY;
+            mz += child.mass * child.comZ;
+        }
+    }
+
+    OctreeNode& root = tree.nodes[0];
+    root.mass = mass;
+    root.comX = mx / mass;
+    root.comY = my / mass;
+    root.comZ = mz / mass;
+    root.size = size;
+    root.begin = 0;
+    root.end = (unsigned int)n;
+    root.leaf = 0;
+    root.next = (unsigned int)tree.nodes.size();
+}
+
+// Interaction list for one leaf: accepted cells as point masses plus the bodies of opened leaves
+struct InteractionList
+{
+    std::vector<double> x, y, z, mass;
+
+    void clear() { x.clear(); y.clear(); z.clear(); mass.clear(); }
+    void add(double px, double py, double pz, double m) { x.push_back(px); y.push_back(py); z.push_back(pz); mass.push_back(m); }
+};
+
+// Walks the tree once per leaf rather than once per body. A cell is used as a point mass when
+// size / distance < theta, measuring the distance to the closest point of the leaf's bounding box,
+// so the test holds for every body in the leaf. The leaf's bodies are then summed against the
+// collected list with the same SIMD kernel as direct summation.
+void accumulateBarnesHutLeaf(NBodySystem& system, const Octree& tree, const OctreeNode& leaf, InteractionList& list)
+{
+    const OctreeNode* nodes = tree.nodes.data();
+    const unsigned int count = (unsigned int)tree.nodes.size();
+    const double theta2 = system.theta * system.theta;
+
+    double minX = tree.x[leaf.begin], maxX = minX;
+    double minY = tree.y[leaf.begin], maxY = minY;
+    double minZ = tree.z[leaf.begin], maxZ = minZ;
+    for (unsigned int j = leaf.begin + 1; j < leaf.end; ++j)
+    {
+        minX = std::min(minX, tree.x[j]); maxX = std::max(maxX, tree.x[j]);
+        minY = std::min(minY, tree.y[j]); maxY = std::max(maxY, tree.y[j]);
+        minZ = std::min(minZ, tree.z[j]); maxZ = std::max(maxZ, tree.z[j]);
+    }
+
+    list.clear();
+    unsigned int n = 0;
+    while (n < count)
+    {
+        const OctreeNode& node = nodes[n];
+        double dx = std::max(0.0, std::max(minX - node.comX, node.comX - maxX));
+        double dy = std::max(0.0, std::max(minY - node.comY, node.comY - maxY));
+        double dz = std::max(0.0, std::max(minZ - node.comZ, node.comZ - maxZ));
+        if (node.size * node.size < theta2 * (dx * dx + dy * dy + dz * dz))
+        {
+            list.add(node.comX, node.comY, node.comZ, node.mass);
+            n = node.next;
+        }
+        else if (node.leaf)
+        {
+            for (unsigned int j = node.begin; j < node.end; ++j)
+                list.add(tree.x[j], tree.y[j], tree.z[j], tree.mass[j]);
+            n = node.next;
+        }
+        else
+            n++;
+    }
+
+    for (unsigned int k = leaf.begin; k < leaf.end; ++k)
+    {
+        double sx = 0.0, sy = 0.0, sz = 0.0;
+        sumGravity(list.x.data(), list.y.data(), list.z.data(), list.mass.data(), list.mass.size(), system.softening2,
+            tree.x[k], tree.y[k], tree.z[k], sx, sy, sz);
+        unsigned int i = tree.keys[k].second;
+        system.ax[i] = system.G * sx;
+        system.ay[i] = system.G * sy;
+        system.az[i] = system.G * sz;
+    }
+}
+
+void accumulateBarnesHut(NBodySystem& system)
+{
+    Octree& tree = system.tree;
+    tree.leaves.clear();
+    for (unsigned int n = 0; n < tree.nodes.size(); ++n)
+        if (tree.nodes[n].leaf)
+            tree.leaves.push_back(n);
+
+    parallelFor(tree.leaves.size(), 64, [&](size_t begin, size_t end) {
+        InteractionList list;
+        for (size_t l = begin; l < end; ++l)
+            accumulateBarnesHutLeaf(system, tree, tree.nodes[tree.leaves[l]], list);
+    });
+}
+
+void computeAccelerations(NBodySystem& system)
+{
+    if (system.solver == ForceSolver::BarnesHut)
+    {
+        buildOctree(system.tree, system);
+        accumulateBarnesHut(system);
+    }
+    else
+    {
+        parallelFor(system.mass.size(), 256, [&](size_t begin, size_t end) {
+            accumulateAccelerations(system, begin, end);
+        });
+    }
+    system.accelerationValid = true;
+}
+
+void drift(NBodySystem& system, double h)
+{
+    size_t n = system.mass.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+        system.x[i] += system.vx[i] * h;
+        system.y[i] += system.vy[i] * h;
+        system.z[i] += system.vz[i] * h;
+    }
+}
+
+void kick(NBodySystem& system, double h)
+{
+    size_t n = system.mass.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+        system.vx[i] += system.ax[i] * h;
+        system.vy[i] += system.ay[i] * h;
+        system.vz[i] += system.az[i] * h;
+    }
+}
+
+// One fixed step. Leapfrog is kick-drift-kick and reuses the last acceleration (one force
+// evaluation per step); Yoshida is the 4th order symplectic composition (three per step).
+void stepNBody(NBodySystem& system)
+{
+    double h = system.dt;
+    if (system.integrator == Integrator::Leapfrog)
+    {
+        if (!system.accelerationValid)
+            computeAccelerations(system);
+        kick(system, 0.5 * h);
+        drift(system, h);
+        computeAccelerations(system);
+        kick(system, 0.5 * h);
+    }
+    else
+    {
+        const double cbrt2 = std::cbrt(2.0);
+        const double w1 = 1.0 / (2.0 - cbrt2), w0 = -cbrt2 / (2.0 - cbrt2);
+        const double c[4] = { 0.5 * w1, 0.5 * (w0 + w1), 0.5 * (w0 + w1), 0.5 * w1 };
+        const double d[3] = { w1, w0, w1 };
+        for (int k = 0; k < 3; ++k)
+        {
+            drift(system, c[k] * h);
+            computeAccelerations(system);
+            kick(system, d[k] * h);
+        }
+        drift(system, c[3] * h);
+        system.accelerationValid = false;
+    }
+    system.time += h;
+    system.steps++;
+}
+
+// Steps until the system time reaches or passes the given day, keeping the state from before the
+// last step so rendering can interpolate between the two. Stops early once budgetSeconds of
+// stepping is used up (0 for no limit) and returns whether the day was reached.
+bool advanceNBody(NBodySystem& system, double day, double budgetSeconds = 0.0)
+{
+    if (system.px.size() != system.x.size())
+    {
+        system.px = system.x; system.py = system.y; system.pz = system.z;
+        system.previousTime = system.time;
+    }
+    auto start = std::chrono::steady_clock::now();
+    while (system.time < day - 1e-9)
+    {
+        system.px = system.x; system.py = system.y; system.pz = system.z;
+        system.previousTime = system.time;
+        stepNBody(system);
+        if (budgetSeconds > 0.0 && system.time < day - 1e-9 &&
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > budgetSeconds)
+            return false;
+    }
+    return true;
+}
+
+// Blend factor between the previous and current state for the given day
+double blendFactor(double previousTime, double time, double day)
+{
+    double span = time - previousTime;
+    if (span <= 0.0)
+        return 1.0;
+    return std::min(std::max((day - previousTime) / span, 0.0), 1.0);
+}
+
+double nbodyInterpolation(const NBodySystem& system, double day)
+{
+    if (system.px.size() != system.x.size())
+        return 1.0;
+    return blendFactor(system.previousTime, system.time, day);
+}
+
+// Positions of every body after a step and one step before, copied out of the system so the
+// renderer can read them while the simulation thread carries on stepping
+struct WorldSnapshot
+{
+    std::vector<double> x, y, z;
+    std::vector<double> px, py, pz;
+    double time = 0.0, previousTime = 0.0;
+};
+
+void takeSnapshot(WorldSnapshot& snapshot, const NBodySystem& system)
+{
+    snapshot.x = system.x; snapshot.y = system.y; snapshot.z = system.z;
+    snapshot.px = system.px; snapshot.py = system.py; snapshot.pz = system.pz;
+    snapshot.time = system.time;
+    snapshot.previousTime = system.previousTime;
+}
+
+// Lock-free single producer, single consumer triple buffer. The writer fills its back slot and
+// swaps it with the shared middle one; the reader swaps its front slot with the middle one only
+// when that holds something newer. Neither side ever waits, and the reader always keeps a
+// complete state to draw from.
+template <typename T>
+struct TripleBuffer
+{
+    static const int FRESH = 4; // set on the middle index while it holds an unread slot
+
+    T slots[3];
+    std::atomic<int> middle{ 1 };
+    int back = 0;  // writer only
+    int front = 2; // reader only
+
+    T& writeSlot() { return slots[back]; }
+    void publish() { back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & 3; }
+
+    // Switches to the newest published slot, returns false if nothing new was published
+    bool update()
+    {
+        if (!(middle.load(std::memory_order_acquire) & FRESH))
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+        return true;
+    }
+    const T& readSlot() const { return slots[front]; }
+};
+
+// Sun, Earth and Moon with real masses and near circular orbits. The renderer exaggerates the
+// Earth-Moon distance (see nbodyMoonScale) the same way the analytic scene does, and one AU is
+// the scene's Earth orbit radius.
+NBodySystem nbody;
+PhysicsMode physicsMode = PhysicsMode::Analytic;
+int nbodySun = -1, nbodyEarth = -1, nbodyMoon = -1, nbodyFirstAsteroid = -1;
+const double EARTH_MOON_DISTANCE = 0.00256955529;    // AU
+
+double nbodyMoonScale()
+{
+    return scene.moonOrbitRadius / EARTH_MOON_DISTANCE;
+}
+
+// Puts the barycentre at rest so the system does not drift off screen
+void stopBarycentreDrift(NBodySystem& system)
+{
+    double px = 0.0, py = 0.0, pz = 0.0, total_mass = 0.0;
+    for (size_t i = 0; i < system.mass.size(); ++i)
+    {
+        px += system.mass[i] * system.vx[i];
+        py += system.mass[i] * system.vy[i];
+        pz += system.mass[i] * system.vz[i];
+        total_mass += system.mass[i];
+    }
+    for (size_t i = 0; i < system.mass.size(); ++i)
+    {
+        system.vx[i] -= px / total_mass;
+        system.vy[i] -= py / total_mass;
+        system.vz[i] -= pz / total_mass;
+    }
+}
+
+void buildSolarSystemNBody(int asteroidCount, Integrator integrator, double stepDays)
+{
+    nbody = NBodySystem();
+    nbody.integrator = integrator;
+    nbody.dt = stepDays;
+    size_t total = 3 + (size_t)std::max(0, asteroidCount);
+    for (std::vector<double>* v : { &nbody.x, &nbody.y, &nbody.z, &nbody.vx, &nbody.vy, &nbody.vz,
+        &nbody.ax, &nbody.ay, &nbody.az, &nbody.mass })
+        v->reserve(total);
+
+    const double sunMass = 1.0, earthMass = 3.0034896e-6, moonMass = 3.6943e-8;
+    const double G = nbody.G;
+
+    // At day 0 the analytic scene has the Earth on +x moving towards -z (rotation about +y)
+    double earthSpeed = std::sqrt(G * (sunMass + earthMass + moonMass) / 1.0);
+    double moonSpeed = std::sqrt(G * (earthMass + moonMass) / EARTH_MOON_DISTANCE);
+    nbodySun = addBody(nbody, glm::dvec3(0.0, 0.0, 0.0), glm::dvec3(0.0, 0.0, 0.0), sunMass);
+    nbodyEarth = addBody(nbody, glm::dvec3(1.0, 0.0, 0.0), glm::dvec3(0.0, 0.0, -earthSpeed), earthMass);
+    nbodyMoon = addBody(nbody, glm::dvec3(1.0 + EARTH_MOON_DISTANCE, 0.0, 0.0),
+        glm::dvec3(0.0, 0.0, -earthSpeed - moonSpeed), moonMass);
+
+    // Main belt between 2.1 and 3.3 AU, tiny masses but still part of the mutual gravity sum
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<double> radius(2.1, 3.3), angle(0.0, 2.0 * 3.14159265358979323846);
+    std::normal_distribution<double> inclination(0.0, 0.05);
+    nbodyFirstAsteroid = (int)nbody.mass.size();
+    for (int i = 0; i < asteroidCount; ++i)
+    {
+        double r = radius(rng), theta = angle(rng), tilt = inclination(rng);
+        double speed = std::sqrt(G * sunMass / r);
+        glm::dvec3 position(r * std::cos(theta) * std::cos(tilt), r * std::sin(tilt), -r * std::sin(theta) * std::cos(tilt));
+        glm::dvec3 velocity(-speed * std::sin(theta), 0.0, -speed * std::cos(theta));
+        addBody(nbody, position, velocity, 1e-12);
+    }
+
+    stopBarycentreDrift(nbody);
+}
+
+double nbodyAlpha = 1.0; // interpolation between the last two N-body states, set once per frame
+const WorldSnapshot* renderSnapshot = nullptr; // read instead of nbody while the simulation runs on its own thread
+
+size_t nbodyCount()
+{
+    return renderSnapshot ? renderSnapshot->x.size() : nbody.mass.size();
+}
+
+glm::dvec3 nbodyInterpolated(int body)
+{
+    const std::vector<double>& x = renderSnapshot ? renderSnapshot->x : nbody.x;
+    const std::vector<double>& y = renderSnapshot ? renderSnapshot->y : nbody.y;
+    const std::vector<double>& z = renderSnapshot ? renderSnapshot->z : nbody.z;
+    if (nbodyAlpha >= 1.0)
+        return glm::dvec3(x[body], y[body], z[body]);
+    const std::vector<double>& px = renderSnapshot ? renderSnapshot->px : nbody.px;
+    const std::vector<double>& py = renderSnapshot ? renderSnapshot->py : nbody.py;
+    const std::vector<double>& pz = renderSnapshot ? renderSnapshot->pz : nbody.pz;
+    double a = nbodyAlpha, b = 1.0 - nbodyAlpha;
+    return glm::dvec3(b * px[body] + a * x[body], b * py[body] + a * y[body], b * pz[body] + a * z[body]);
+}
+
+glm::vec3 nbodyPosition(int body)
+{
+    glm::dvec3 p = nbodyInterpolated(body);
+    return glm::vec3((float)p.x, (float)p.y, (float)p.z);
+}
+
+// Scene graph
+// Nodes live in flat arrays in topological order (a parent always comes before its children),
+// so updating every world transform is one linear pass. A node's world matrix is only rebuilt
+// when its own local transform or its parent's world transform changed since the last update.
+struct SceneGraph
+{
+    std::vector<int> parent;              // -1 for roots
+    std::vector<glm::mat4> local;
+    std::vector<glm::mat4> world;
+    std::vector<unsigned char> localDirty;
+    std::vector<unsigned char> worldChanged; // set by the last update, read by the children
+    std::vector<std::string> name;
+};
+
+int addSceneNode(SceneGraph& graph, const std::string& name, int parent)
+{
+    int index = (int)graph.parent.size();
+    if (parent >= index)
+    {
+        std::cout << "Scene node " << name << " must be added after its parent" << std::endl;
+        parent = -1;
+    }
+    graph.parent.push_back(parent);
+    graph.local.push_back(glm::mat4(1.0f));
+    graph.world.push_back(glm::mat4(1.0f));
+    graph.localDirty.push_back(1);
+    graph.worldChanged.push_back(0);
+    graph.name.push_back(name);
+    return index;
+}
+
+// Marks the node dirty only when the transform differs from the one it already has, so nodes
+// whose inputs did not move since the last update (a repeated day, a node the mode never sets)
+// keep their world matrix and let their children keep theirs
+void setLocalTransform(SceneGraph& graph, int node, const glm::mat4& transform)
+{
+    if (graph.local[node] == transform)
+        return;
+    graph.local[node] = transform;
+    graph.localDirty[node] = 1;
+}
+
+void updateWorldTransforms(SceneGraph& graph)
+{
+    size_t count = graph.parent.size();
+    for (size_t i = 0; i < count; ++i)
+    {
+        int p = graph.parent[i];
+        bool changed = graph.localDirty[i] || (p >= 0 && graph.worldChanged[p]);
+        if (changed)
+            graph.world[i] = p >= 0 ? graph.world[p] * graph.local[i] : graph.local[i];
+        graph.worldChanged[i] = changed;
+        graph.localDirty[i] = 0;
+    }
+}
+
+glm::vec3 worldPosition(const SceneGraph& graph, int node)
+{
+    return glm::vec3(graph.world[node][3]);
+}
+
+// Sun -> Earth -> Moon
+// Each body has an orbit node (its centre, what the camera looks at and children orbit around)
+// and a body node below it carrying its spin, so a body's spin never drags its moons along.
+SceneGraph sceneGraph;
+int sunNode, sunBodyNode, earthNode, earthBodyNode, moonNode, moonBodyNode;
+
+void buildSolarSystemGraph()
+{
+    sceneGraph = SceneGraph();
+    sunNode = addSceneNode(sceneGraph, "sun", -1);
+    sunBodyNode = addSceneNode(sceneGraph, "sun body", sunNode);
+    earthNode = addSceneNode(sceneGraph, "earth", sunNode);
+    earthBodyNode = addSceneNode(sceneGraph, "earth body", earthNode);
+    moonNode = addSceneNode(sceneGraph, "moon", earthNode);
+    moonBodyNode = addSceneNode(sceneGraph, "moon body", moonNode);
+}
+
+// Offset between two N-body bodies in scene units, taken in double before narrowing
+glm::vec3 nbodyOffset(int from, int to, double scale)
+{
+    glm::dvec3 a = nbodyInterpolated(from), b = nbodyInterpolated(to);
+    return glm::vec3((float)((b.x - a.x) * scale), (float)((b.y - a.y) * scale), (float)((b.z - a.z) * scale));
+}
+
+// Ephemeris
+// Trajectories baked ahead of time into per-segment Chebyshev coefficients, in the spirit of JPL
+// SPK type 2 files. The file is memory mapped and used in place: a lookup picks the segment by
+// division and sums one short Chebyshev series per axis, so seeking anywhere costs the same.
+//
+// Layout (little-endian): EphemerisHeader, double mass[bodyCount], then for every segment, body
+// and axis (x, y, z) degree + 1 doubles of coefficients. Positions are in AU, times in days.
+const char EPHEMERIS_MAGIC[8] = { 'S', 'S', 'E', 'P', 'H', 'E', 'M', '\0' };
+const uint32_t EPHEMERIS_VERSION = 1;
+
+struct EphemerisHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t bodyCount;
+    uint32_t firstAsteroid;
+    uint32_t degree;        // coefficients per axis are degree + 1
+    uint64_t segmentCount;
+    double startDay;
+    double segmentDays;
+};
+
+// Read-only view of a whole file
+struct MappedFile
+{
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE, mapping = NULL;
+#else
+    int fd = -1;
+#endif
+};
+
+void closeMappedFile(MappedFile& mapped)
+{
+#ifdef _WIN32
+    if (mapped.data)
+        UnmapViewOfFile(mapped.data);
+    if (mapped.mapping)
+        CloseHandle(mapped.mapping);
+    if (mapped.file != INVALID_HANDLE_VALUE)
+        CloseHandle(mapped.file);
+#else
+    if (mapped.data)
+        munmap((void*)mapped.data, mapped.size);
+    if (mapped.fd >= 0)
+        close(mapped.fd);
+#endif
+    mapped = MappedFile();
+}
+
+bool openMappedFile(const std::string& path, MappedFile& mapped)
+{
+    mapped = MappedFile();
+#ifdef _WIN32
+    mapped.file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER size;
+    if (mapped.file == INVALID_HANDLE_VALUE || !GetFileSizeEx(mapped.file, &size) || size.QuadPart == 0)
+    {
+        closeMappedFile(mapped);
+        return false;
+    }
+    mapped.size = (size_t)size.QuadPart;
+    mapped.mapping = CreateFileMappingA(mapped.file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapped.mapping)
+        mapped.data = (const unsigned char*)MapViewOfFile(mapped.mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+    mapped.fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (mapped.fd < 0 || fstat(mapped.fd, &info) != 0 || info.st_size == 0)
+    {
+        closeMappedFile(mapped);
+        return false;
+    }
+    mapped.size = (size_t)info.st_size;
+    void* data = mmap(NULL, mapped.size, PROT_READ, MAP_PRIVATE, mapped.fd, 0);
+    mapped.data = data == MAP_FAILED ? nullptr : (const unsigned char*)data;
+#endif
+    if (!mapped.data)
+    {
+        closeMappedFile(mapped);
+        return false;
+    }
+    return true;
+}
+
+struct Ephemeris
+{
+    MappedFile file;
+    const EphemerisHeader* header = nullptr;
+    const double* masses = nullptr;
+    const double* coefficients = nullptr;
+};
+
+Ephemeris ephemeris;
+
+size_t ephemerisSegmentDoubles(const EphemerisHeader& header)
+{
+    return (size_t)header.bodyCount * 3 * (header.degree + 1);
+}
+
+bool openEphemeris(const std::string& path, Ephemeris& eph)
+{
+    if (!openMappedFile(path, eph.file))
+    {
+        std::cout << "Cannot open ephemeris " << path << std::endl;
+        return false;
+    }
+    // The Sun, Earth and Moon are always bodies 0, 1 and 2 (see loadEphemerisBodies)
+    const EphemerisHeader* header = (const EphemerisHeader*)eph.file.data;
+    bool valid = eph.file.size >= sizeof(EphemerisHeader) &&
+        memcmp(header->magic, EPHEMERIS_MAGIC, sizeof(EPHEMERIS_MAGIC)) == 0 &&
+        header->version == EPHEMERIS_VERSION && header->bodyCount >= 3 && header->segmentCount > 0 &&
+        header->segmentDays > 0.0 && header->firstAsteroid <= header->bodyCount && header->degree < 64;
+    if (valid)
+    {
+        size_t expected = sizeof(EphemerisHeader) + header->bodyCount * sizeof(double) +
+            header->segmentCount * ephemerisSegmentDoubles(*header) * sizeof(double);
+        valid = eph.file.size == expected;
+    }
+    if (!valid)
+    {
+        std::cout << "Not a version " << EPHEMERIS_VERSION << " ephemeris file: " << path << std::endl;
+        closeMappedFile(eph.file);
+        return false;
+    }
+    eph.header = header;
+    eph.masses = (const double*)(eph.file.data + sizeof(EphemerisHeader));
+    eph.coefficients = eph.masses + header->bodyCount;
+    return true;
+}
+
+void closeEphemeris(Ephemeris& eph)
+{
+    closeMappedFile(eph.file);
+    eph = Ephemeris();
+}
+
+double ephemerisEndDay(const EphemerisHeader& header)
+{
+    return header.startDay + header.segmentCount * header.segmentDays;
+}
+
+// Clenshaw recurrence for sum c[k] T_k(s), s in [-1, 1]
+inline double chebyshevSum(const double* c, int count, double s)
+{
+    double b1 = 0.0, b2 = 0.0;
+    for (int k = count - 1; k >= 1; --k)
+    {
+        double b0 = 2.0 * s * b1 - b2 + c[k];
+        b2 = b1;
+        b1 = b0;
+    }
+    return s * b1 - b2 + c[0];
+}
+
+// Writes every body's position at the given day, clamped to the file's time span
+void evaluateEphemeris(const Ephemeris& eph, double day, double* x, double* y, double* z)
+{
+    const EphemerisHeader& header = *eph.header;
+    double offset = std::min(std::max(day - header.startDay, 0.0), header.segmentCount * header.segmentDays);
+    uint64_t segment = std::min((uint64_t)(offset / header.segmentDays), header.segmentCount - 1);
+    double s = 2.0 * (offset - segment * header.segmentDays) / header.segmentDays - 1.0;
+
+    int count = (int)header.degree + 1;
+    const double* c = eph.coefficients + segment * ephemerisSegmentDoubles(header);
+    for (uint32_t body = 0; body < header.bodyCount; ++body, c += 3 * count)
+    {
+        x[body] = chebyshevSum(c, count, s);
+        y[body] = chebyshevSum(c + count, count, s);
+        z[body] = chebyshevSum(c + 2 * count, count, s);
+    }
+}
+
+// Stands the N-body arrays up as the ephemeris' bodies so the renderer can read positions from them
+bool loadEphemerisBodies(const std::string& path)
+{
+    closeEphemeris(ephemeris);
+    if (!openEphemeris(path, ephemeris))
+        return false;
+    const EphemerisHeader& header = *ephemeris.header;
+    nbody = NBodySystem();
+    for (uint32_t body = 0; body < header.bodyCount; ++body)
+        addBody(nbody, glm::dvec3(0.0, 0.0, 0.0), glm::dvec3(0.0, 0.0, 0.0), ephemeris.masses[body]);
+    nbodySun = 0;
+    nbodyEarth = 1;
+    nbodyMoon = 2;
+    nbodyFirstAsteroid = (int)header.firstAsteroid;
+    return true;
+}
+
+// Steps to exactly the given day, shortening the final step to land on it
+void advanceNBodyExactly(NBodySystem& system, double day)
+{
+    double step = system.dt;
+    while (system.time < day - 1e-12)
+    {
+        system.dt = std::min(step, day - system.time);
+        stepNBody(system);
+    }
+    system.dt = step;
+}
+
+// Integrates the system over [startDay, endDay] and fits every segment with degree + 1 Chebyshev
+// coefficients per axis, sampled at the Chebyshev nodes. The fit is checked against the integrator
+// three quarters of the way through each segment, which is never a node.
+bool bakeEphemeris(const std::string& path, NBodySystem& system, int firstAsteroid,
+    double startDay, double endDay, double segmentDays, int degree)
+{
+    EphemerisHeader header = {};
+    memcpy(header.magic, EPHEMERIS_MAGIC, sizeof(EPHEMERIS_MAGIC));
+    header.version = EPHEMERIS_VERSION;
+    header.bodyCount = (uint32_t)system.mass.size();
+    header.firstAsteroid = (uint32_t)firstAsteroid;
+    header.degree = (uint32_t)degree;
+    header.segmentCount = (uint64_t)std::max(1.0, ceil((endDay - startDay) / segmentDays - 1e-9));
+    header.startDay = startDay;
+    header.segmentDays = segmentDays;
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cout << "Cannot write ephemeris " << path << std::endl;
+        return false;
+    }
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)system.mass.data(), system.mass.size() * sizeof(double));
+
+    const int count = degree + 1;
+    const double PI = glm::pi<double>();
+    const double CHECK_S = 0.5;
+    size_t bodies = system.mass.size();
+    std::vector<double> samples(bodies * 3 * count), checks(bodies * 3);
+    std::vector<double> coefficients(ephemerisSegmentDoubles(header));
+    double worstError = 0.0;
+    advanceNBodyExactly(system, startDay);
+    for (uint64_t segment = 0; segment < header.segmentCount; ++segment)
+    {
+        double begin = startDay + segment * segmentDays, half = 0.5 * segmentDays, mid = begin + half;
+
+        // Node k sits at s = cos(pi (k + 1/2) / count), so walking k downwards goes forward in time
+        bool checked = false;
+        for (int k = count - 1; k >= 0; --k)
+        {
+            double s = cos(PI * (k + 0.5) / count);
+            if (!checked && s > CHECK_S)
+            {
+                advanceNBodyExactly(system, mid + half * CHECK_S);
+                for (size_t body = 0; body < bodies; ++body)
+                {
+                    checks[body * 3] = system.x[body];
+                    checks[body * 3 + 1] = system.y[body];
+                    checks[body * 3 + 2] = system.z[body];
+                }
+                checked = true;
+            }
+            advanceNBodyExactly(system, mid + half * s);
+            for (size_t body = 0; body < bodies; ++body)
+            {
+                double* sample = &samples[body * 3 * count];
+                sample[k] = system.x[body];
+                sample[count + k] = system.y[body];
+                sample[2 * count + k] = system.z[body];
+            }
+        }
+
+        for (size_t series = 0; series < bodies * 3; ++series)
+        {
+            const double* sample = &samples[series * count];
+            double* c = &coefficients[series * count];
+            for (int j = 0; j < count; ++j)
+            {
+                double sum = 0.0;
+                for (int k = 0; k < count; ++k)
+                    sum += sample[k] * cos(PI * j * (k + 0.5) / count);
+                c[j] = (j == 0 ? 1.0 : 2.0) * sum / count;
+            }
+            worstError = std::max(worstError, fabs(chebyshevSum(c, count, CHECK_S) - checks[series]));
+        }
+        file.write((const char*)coefficients.data(), coefficients.size() * sizeof(double));
+        advanceNBodyExactly(system, begin + segmentDays);
+    }
+    if (!file.good())
+    {
+        std::cout << "Failed writing ephemeris " << path << std::endl;
+        return false;
+    }
+    std::cout << "Baked " << header.segmentCount << " segments of " << bodies << " bodies over days "
+        << startDay << " to " << ephemerisEndDay(header) << ", worst fit error " << worstError
+        << " AU (" << worstError * 149597870.7 << " km)" << std::endl;
+    return true;
+}
+
+// Scene files
+// A scene sets the parameters above and can bring a catalog of extra bodies (heliocentric
+// positions in AU, velocities in AU/day, masses in solar masses) that join the N-body system in
+// place of or next to the generated belt. Three formats, chosen by extension:
+//   .csv   optional "# key = value" parameter lines, a header naming the columns (x, y, z, mass and
+//          optionally vx, vy, vz; others are ignored), then one body per row
+//   .json  an object with parameter keys and "bodies": an array of [x, y, z, vx, vy, vz, mass]
+//          arrays or of objects keyed like the CSV columns
+//   .ssbin the binary form written by --save-scene: SceneFileHeader, then each column as
+//          bodyCount doubles. It is memory mapped and the columns are used in place.
+// Text is parsed in two passes over chunks split at line (or element) starts, one job per chunk:
+// the first counts rows so every chunk knows where its bodies go, the second parses numbers
+// with std::from_chars straight into the column arrays. Bodies without velocities get a circular
+// orbit about the Sun in the plane of the ecliptic.
+enum CatalogColumn { COLUMN_X, COLUMN_Y, COLUMN_Z, COLUMN_VX, COLUMN_VY, COLUMN_VZ, COLUMN_MASS, CATALOG_COLUMNS };
+const char* const CATALOG_COLUMN_NAMES[CATALOG_COLUMNS] = { "x", "y", "z", "vx", "vy", "vz", "mass" };
+
+struct BodyCatalog
+{
+    size_t count = 0;
+    const double* columns[CATALOG_COLUMNS] = {};
+    std::vector<double> storage; // column after column, for text imports
+    MappedFile mapped;           // for binary scenes
+};
+
+BodyCatalog sceneCatalog;
+
+const char SCENE_MAGIC[8] = { 'S', 'S', 'S', 'C', 'E', 'N', 'E', '\0' };
+const uint32_t SCENE_VERSION = 1;
+const int SCENE_FILE_PARAMETERS = 16; // room for later parameters
+
+struct SceneFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t parameterCount;
+    uint64_t bodyCount;
+    double parameters[SCENE_FILE_PARAMETERS]; // in SCENE_PARAMETERS order
+};
+
+// Sets a parameter if the value suits it, otherwise prints why not
+bool setSceneParameter(SceneDescription& description, const SceneParameter& parameter, double value)
+{
+    if (!std::isfinite(value) || (parameter.positive && value <= 0.0))
+    {
+        std::cout << "Scene parameter " << parameter.name << " must be " << (parameter.positive ? "positive" : "finite")
+            << ", got " << value << std::endl;
+        return false;
+    }
+    description.*parameter.field = value;
+    return true;
+}
+
+bool setSceneParameter(SceneDescription& description, const std::string& name, double value)
+{
+    for (const SceneParameter& parameter : SCENE_PARAMETERS)
+        if (name == parameter.name)
+            return setSceneParameter(description, parameter, value);
+    std::cout << "Unknown scene parameter: " << name << std::endl;
+    return false;
+}
+
+// Number at p (leading blanks and '+' allowed), advancing p past it
+inline bool parseNumber(const char*& p, const char* end, double& value)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        ++p;
+    if (p < end && *p == '+')
+        ++p;
+    std::from_chars_result result = std::from_chars(p, end, value);
+    if (result.ec != std::errc())
+        return false;
+    p = result.ptr;
+    return true;
+}
+
+inline const char* nextLine(const char* p, const char* end)
+{
+    if (p >= end)
+        return end;
+    const char* newline = (const char*)std::memchr(p, '\n', end - p);
+    return newline ? newline + 1 : end;
+}
+
+inline bool blankLine(const char* p, const char* lineEnd)
+{
+    for (; p < lineEnd; ++p)
+        if (*p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+            return false;
+    return true;
+}
+
+void allocateCatalog(BodyCatalog& catalog, size_t count)
+{
+    catalog.count = count;
+    catalog.storage.assign(count * CATALOG_COLUMNS, 0.0);
+    for (int c = 0; c < CATALOG_COLUMNS; ++c)
+        catalog.columns[c] = catalog.storage.data() + c * count;
+}
+
+inline double* catalogColumn(BodyCatalog& catalog, int column)
+{
+    return catalog.storage.data() + column * catalog.count;
+}
+
+// Circular heliocentric velocities for bodies loaded without any, same as the generated belt
+void giveCircularVelocities(BodyCatalog& catalog)
+{
+    double* x = catalogColumn(catalog, COLUMN_X), * z = catalogColumn(catalog, COLUMN_Z);
+    double* vx = catalogColumn(catalog, COLUMN_VX), * vz = catalogColumn(catalog, COLUMN_VZ);
+    parallelFor(catalog.count, 16384, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            double r = std::sqrt(x[i] * x[i] + z[i] * z[i]);
+            if (r <= 0.0)
+                continue;
+            double speed = std::sqrt(GAUSSIAN_GRAVITY / r);
+            vx[i] = speed * z[i] / r;
+            vz[i] = -speed * x[i] / r;
+        }
+    });
+}
+
+// Splits [begin, end) into pieces starting right after a separator character, about four per thread
+std::vector<const char*> splitText(const char* begin, const char* end, char separator)
+{
+    size_t pieces = std::max<size_t>(1, std::min(jobThreadCount() * 4, (size_t)(end - begin) / 65536));
+    std::vector<const char*> bounds(1, begin);
+    for (size_t k = 1; k < pieces; ++k)
+    {
+        const char* p = std::max(bounds.back(), begin + (end - begin) * k / pieces);
+        const char* found = (const char*)std::memchr(p, separator, end - p);
+        bounds.push_back(found ? found + (separator == '\n' ? 1 : 0) : end);
+    }
+    bounds.push_back(end);
+    return bounds;
+}
+
+// Exclusive prefix sum of per-piece counts, returns the total
+size_t pieceOffsets(std::vector<size_t>& counts)
+{
+    size_t total = 0;
+    for (size_t& count : counts)
+    {
+        size_t here = count;
+        count = total;
+        total += here;
+    }
+    return total;
+}
+
+bool parseCatalogCSV(const char* begin, const char* end, SceneDescription& description, BodyCatalog& catalog)
+{
+    // Parameter lines, then the header
+    const char* p = begin;
+    for (; p < end && (*p == '#' || blankLine(p, nextLine(p, end))); p = nextLine(p, end))
+    {
+        const char* lineEnd = nextLine(p, end);
+        const char* equals = (const char*)std::memchr(p, '=', lineEnd - p);
+        if (*p != '#' || !equals)
+            continue;
+        std::string name(p + 1, equals);
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t") + 1);
+        const char* valueStart = equals + 1;
+        double value;
+        if (!parseNumber(valueStart, lineEnd, value))
+        {
+            std::cout << "Invalid value for scene parameter: " << name << std::endl;
+            return false;
+        }
+        if (!setSceneParameter(description, name, value))
+            return false;
+    }
+
+    std::vector<int> fieldColumn;
+    bool present[CATALOG_COLUMNS] = {};
+    const char* headerEnd = nextLine(p, end);
+    for (const char* field = p; field < headerEnd; )
+    {
+        const char* fieldEnd = field;
+        while (fieldEnd < headerEnd && *fieldEnd != ',' && *fieldEnd != '\n' && *fieldEnd != '\r')
+            ++fieldEnd;
+        std::string name(field, fieldEnd);
+        name.erase(0, name.find_first_not_of(" \t\""));
+        name.erase(name.find_last_not_of(" \t\"") + 1);
+        int column = -1;
+        for (int c = 0; c < CATALOG_COLUMNS; ++c)
+            if (name == CATALOG_COLUMN_NAMES[c])
+                column = c;
+        if (column >= 0)
+            present[column] = true;
+        fieldColumn.push_back(column);
+        field = fieldEnd < headerEnd && *fieldEnd == ',' ? fieldEnd + 1 : headerEnd;
+    }
+    if (!present[COLUMN_X] || !present[COLUMN_Y] || !present[COLUMN_Z] || !present[COLUMN_MASS])
+    {
+        std::cout << "Catalog header needs x, y, z and mass columns" << std::endl;
+        return false;
+    }
+
+    std::vector<const char*> bounds = splitText(headerEnd, end, '\n');
+    size_t pieces = bounds.size() - 1;
+    std::vector<size_t> offsets(pieces, 0);
+    parallelFor(pieces, 1, [&](size_t first, size_t last) {
+        for (size_t k = first; k < last; ++k)
+            for (const char* line = bounds[k]; line < bounds[k + 1]; line = nextLine(line, bounds[k + 1]))
+                offsets[k] += blankLine(line, nextLine(line, bounds[k + 1])) ? 0 : 1;
+    });
+    allocateCatalog(catalog, pieceOffsets(offsets));
+
+    std::vector<size_t> badRow(pieces, 0); // first unparsable row of each piece plus one
+    double* out[CATALOG_COLUMNS];
+    for (int c = 0; c < CATALOG_COLUMNS; ++c)
+        out[c] = catalogColumn(catalog, c);
+    parallelFor(pieces, 1, [&](size_t first, size_t last) {
+        for (size_t k = first; k < last; ++k)
+        {
+            size_t row = offsets[k];
+            for (const char* line = bounds[k]; line < bounds[k + 1] && !badRow[k]; )
+            {
+                const char* lineEnd = nextLine(line, bounds[k + 1]);
+                if (blankLine(line, lineEnd))
+                {
+                    line = lineEnd;
+                    continue;
+                }
+                const char* q = line;
+                for (size_t f = 0; f < fieldColumn.size(); ++f)
+                {
+                    double value = 0.0;
+                    if (fieldColumn[f] >= 0)
+                    {
+                        if (!parseNumber(q, lineEnd, value))
+                        {
+                            q = nullptr;
+                            break;
+                        }
+                        out[fieldColumn[f]][row] = value;
+                    }
+                    const char* comma = (const char*)std::memchr(q, ',', lineEnd - q);
+                    if (f + 1 < fieldColumn.size() && !comma)
+                    {
+                        q = nullptr;
+                        break;
+                    }
+                    q = comma ? comma + 1 : lineEnd;
+                }
+                if (!q)
+                    badRow[k] = row + 1;
+                row++;
+                line = lineEnd;
+            }
+        }
+    });
+    for (size_t k = 0; k < pieces; ++k)
+        if (badRow[k])
+        {
+            std::cout << "Catalog body " << badRow[k] << " is malformed" << std::endl;
+            return false;
+        }
+    if (!present[COLUMN_VX] && !present[COLUMN_VY] && !present[COLUMN_VZ])
+        giveCircularVelocities(catalog);
+    return true;
+}
+
+// JSON helpers for the small subset scenes use
+inline const char* skipSpace(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        ++p;
+    return p;
+}
+
+// Reads a string without escapes at p (which must be at the opening quote)
+bool readJsonString(const char*& p, const char* end, std::string& text)
+{
+    if (p >= end || *p != '"')
+        return false;
+    const char* close = (const char*)std::memchr(p + 1, '"', end - p - 1);
+    if (!close)
+        return false;
+    text.assign(p + 1, close);
+    p = close + 1;
+    return true;
+}
+
+// Skips any value, returns nullptr on unbalanced input
+const char* skipJsonValue(const char* p, const char* end)
+{
+    int depth = 0;
+    for (; p < end; ++p)
+    {
+        if (*p == '"')
+        {
+            p = (const char*)std::memchr(p + 1, '"', end - p - 1);
+            if (!p)
+                return nullptr;
+        }
+        else if (*p == '[' || *p == '{')
+            depth++;
+        else if (*p == ']' || *p == '}')
+        {
+            if (depth == 0)
+                return p;
+            if (--depth == 0)
+                return p + 1;
+        }
+        else if (*p == ',' && depth == 0)
+            return p;
+    }
+    return depth == 0 ? p : nullptr;
+}
+
+// One body, [x, y, z, vx, vy, vz, mass] or {"x": ..., "mass": ...}; fills present with the columns seen
+bool parseJsonBody(const char*& p, const char* end, double* values, bool* present)
+{
+    p = skipSpace(p, end);
+    if (p < end && *p == '[')
+    {
+        p++;
+        for (int c = 0; c < CATALOG_COLUMNS; ++c)
+        {
+            p = skipSpace(p, end);
+            if (!parseNumber(p, end, values[c]))
+                return false;
+            present[c] = true;
+            p = skipSpace(p, end);
+            if (p < end && *p == ',')
+                p++;
+        }
+        p = skipSpace(p, end);
+        return p < end && *p++ == ']';
+    }
+    if (p >= end || *p != '{')
+        return false;
+    p++;
+    std::string key;
+    for (p = skipSpace(p, end); p < end && *p != '}'; p = skipSpace(p, end))
+    {
+        if (!readJsonString(p, end, key))
+            return false;
+        p = skipSpace(p, end);
+        if (p >= end || *p++ != ':')
+            return false;
+        p = skipSpace(p, end);
+        int column = -1;
+        for (int c = 0; c < CATALOG_COLUMNS; ++c)
+            if (key == CATALOG_COLUMN_NAMES[c])
+                column = c;
+        if (column >= 0)
+        {
+            if (!parseNumber(p, end, values[column]))
+                return false;
+            present[column] = true;
+        }
+        else if (!(p = skipJsonValue(p, end)))
+            return false;
+        p = skipSpace(p, end);
+        if (p < end && *p == ',')
+            p++;
+    }
+    return p < end && *p++ == '}';
+}
+
+bool parseCatalogJSON(const char* begin, const char* end, SceneDescription& description, BodyCatalog& catalog)
+{
+    const char* p = skipSpace(begin, end);
+    if (p >= end || *p++ != '{')
+    {
+        std::cout << "Scene JSON must be an object" << std::endl;
+        return false;
+    }
+    const char* bodiesBegin = nullptr, * bodiesEnd = nullptr;
+    std::string key;
+    for (p = skipSpace(p, end); p < end && *p != '}'; p = skipSpace(p, end))
+    {
+        if (!readJsonString(p, end, key))
+            break;
+        p = skipSpace(p, end);
+        if (p >= end || *p++ != ':')
+            break;
+        p = skipSpace(p, end);
+        if (key == "bodies" && p < end && *p == '[')
+        {
+            bodiesBegin = p + 1;
+            p = skipJsonValue(p, end);
+            if (!p)
+                break;
+            bodiesEnd = p - 1;
+        }
+        else
+        {
+            double value;
+            if (!parseNumber(p, end, value))
+            {
+                std::cout << "Invalid value for scene parameter " << key << std::endl;
+                return false;
+            }
+            if (!setSceneParameter(description, key, value))
+                return false;
+        }
+        p = skipSpace(p, end);
+        if (p < end && *p == ',')
+            p++;
+    }
+    if (p >= end || *p != '}')
+    {
+        std::cout << "Scene JSON is malformed" << std::endl;
+        return false;
+    }
+    if (!bodiesBegin)
+        return true;
+
+    // Bodies are all arrays or all objects and do not nest, so every '[' (or '{') inside the
+    // array starts one
+    const char* first = skipSpace(bodiesBegin, bodiesEnd);
+    char open = first < bodiesEnd && *first == '{' ? '{' : '[';
+    std::vector<const char*> bounds = splitText(bodiesBegin, bodiesEnd, open);
+    size_t pieces = bounds.size() - 1;
+    std::vector<size_t> offsets(pieces, 0);
+    parallelFor(pieces, 1, [&](size_t firstPiece, size_t lastPiece) {
+        for (size_t k = firstPiece; k < lastPiece; ++k)
+            offsets[k] = std::count(bounds[k], bounds[k + 1], open);
+    });
+    allocateCatalog(catalog, pieceOffsets(offsets));
+
+    double* out[CATALOG_COLUMNS];
+    for (int c = 0; c < CATALOG_COLUMNS; ++c)
+        out[c] = catalogColumn(catalog, c);
+    std::vector<size_t> badBody(pieces, 0);
+    std::vector<char> hasVelocity(pieces, 0);
+    parallelFor(pieces, 1, [&](size_t firstPiece, size_t lastPiece) {
+        for (size_t k = firstPiece; k < lastPiece; ++k)
+        {
+            size_t body = offsets[k], last = k + 1 < pieces ? offsets[k + 1] : catalog.count;
+            for (const char* q = bounds[k]; ; ++body)
+            {
+                while (q < bounds[k + 1] && (*q == ',' || *q == ' ' || *q == '\t' || *q == '\r' || *q == '\n'))
+                    ++q;
+                if (q == bounds[k + 1] && body == last)
+                    break;
+                double values[CATALOG_COLUMNS] = {};
+                bool present[CATALOG_COLUMNS] = {};
+                if (body == last || *q != open || !parseJsonBody(q, bounds[k + 1], values, present) ||
+                    !present[COLUMN_X] || !present[COLUMN_Y] || !present[COLUMN_Z] || !present[COLUMN_MASS])
+                {
+                    badBody[k] = body + 1;
+                    break;
+                }
+                for (int c = 0; c < CATALOG_COLUMNS; ++c)
+                    out[c][body] = values[c];
+                hasVelocity[k] |= present[COLUMN_VX] || present[COLUMN_VY] || present[COLUMN_VZ];
+            }
+        }
+    });
+    for (size_t k = 0; k < pieces; ++k)
+        if (badBody[k])
+        {
+            std::cout << "Scene body " << badBody[k] << " is malformed, nested or lacks x, y, z or mass" << std::endl;
+            return false;
+        }
+    if (std::find(hasVelocity.begin(), hasVelocity.end(), 1) == hasVelocity.end())
+        giveCircularVelocities(catalog);
+    return true;
+}
+
+bool loadBinaryScene(const std::string& path, SceneDescription& description, BodyCatalog& catalog)
+{
+    if (!openMappedFile(path, catalog.mapped))
+        return false;
+    const SceneFileHeader* header = (const SceneFileHeader*)catalog.mapped.data;
+    if (catalog.mapped.size < sizeof(SceneFileHeader) || std::memcmp(header->magic, SCENE_MAGIC, 8) != 0 ||
+        header->version != SCENE_VERSION ||
+        header->bodyCount > (catalog.mapped.size - sizeof(SceneFileHeader)) / (CATALOG_COLUMNS * sizeof(double)))
+    {
+        std::cout << path << " is not a scene file of version " << SCENE_VERSION << std::endl;
+        closeMappedFile(catalog.mapped);
+        return false;
+    }
+    for (uint32_t i = 0; i < header->parameterCount && i < SCENE_PARAMETER_COUNT; ++i)
+        if (!setSceneParameter(description, SCENE_PARAMETERS[i], header->parameters[i]))
+        {
+            closeMappedFile(catalog.mapped);
+            return false;
+        }
+    catalog.count = (size_t)header->bodyCount;
+    const double* data = (const double*)(catalog.mapped.data + sizeof(SceneFileHeader));
+    for (int c = 0; c < CATALOG_COLUMNS; ++c)
+        catalog.columns[c] = data + c * catalog.count;
+    return true;
+}
+
+bool endsWith(const std::string& text, const std::string& suffix)
+{
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool loadScene(const std::string& path, SceneDescription& description, BodyCatalog& catalog)
+{
+    auto start = std::chrono::steady_clock::now();
+    bool ok;
+    if (endsWith(path, ".ssbin"))
+        ok = loadBinaryScene(path, description, catalog);
+    else
+    {
+        MappedFile text;
+        if (!openMappedFile(path, text))
+        {
+            std::cout << "Cannot read scene " << path << std::endl;
+            return false;
+        }
+        const char* begin = (const char*)text.data, * end = begin + text.size;
+        ok = endsWith(path, ".json") ? parseCatalogJSON(begin, end, description, catalog)
+            : parseCatalogCSV(begin, end, description, catalog);
+        closeMappedFile(text);
+    }
+    if (ok)
+        std::cout << "Scene " << path << ": " << catalog.count << " bodies in "
+            << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+    return ok;
+}
+
+bool saveScene(const std::string& path, const SceneDescription& description, const BodyCatalog& catalog)
+{
+    SceneFileHeader header = {};
+    std::memcpy(header.magic, SCENE_MAGIC, 8);
+    header.version = SCENE_VERSION;
+    header.parameterCount = SCENE_PARAMETER_COUNT;
+    header.bodyCount = catalog.count;
+    for (int i = 0; i < SCENE_PARAMETER_COUNT; ++i)
+        header.parameters[i] = description.*SCENE_PARAMETERS[i].field;
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char*)&header, sizeof(header));
+    for (int c = 0; c < CATALOG_COLUMNS; ++c)
+        if (catalog.count)
+            file.write((const char*)catalog.columns[c], catalog.count * sizeof(double));
+    if (!file)
+    {
+        std::cout << "Failed writing scene " << path << std::endl;
+        return false;
+    }
+    std::cout << "Wrote " << path << " with " << catalog.count << " bodies" << std::endl;
+    return true;
+}
+
+// Appends the catalog to the N-body system after the generated bodies, as asteroids. Positions and
+// velocities are taken relative to the Sun.
+void addCatalogBodies(NBodySystem& system, const BodyCatalog& catalog)
+{
+    if (catalog.count == 0)
+        return;
+    size_t first = system.mass.size(), total = first + catalog.count;
+    for (std::vector<double>* v : { &system.x, &system.y, &system.z, &system.vx, &system.vy, &system.vz,
+        &system.ax, &system.ay, &system.az, &system.mass })
+        v->resize(total, 0.0);
+    const double origin[6] = { system.x[nbodySun], system.y[nbodySun], system.z[nbodySun],
+        system.vx[nbodySun], system.vy[nbodySun], system.vz[nbodySun] };
+    double* targets[CATALOG_COLUMNS] = { system.x.data(), system.y.data(), system.z.data(),
+        system.vx.data(), system.vy.data(), system.vz.data(), system.mass.data() };
+    parallelFor(catalog.count, 16384, [&](size_t begin, size_t end) {
+        for (int c = 0; c < CATALOG_COLUMNS; ++c)
+        {
+            double offset = c < 6 ? origin[c] : 0.0;
+            for (size_t i = begin; i < end; ++i)
+                targets[c][first + i] = catalog.columns[c][i] + offset;
+        }
+    });
+    system.accelerationValid = false;
+    stopBarycentreDrift(system);
+}
+
+// Keplerian orbits
+// Two-body motion from orbital elements (a, e, i, node, argument of periapsis, mean anomaly at
+// day 0), solved in closed form for any day, so a catalog-sized population costs one pass over
+// its arrays per frame and nothing between frames. Each orbit is stored ready for evaluation:
+//   position = P (cos E - e) + Q sin E
+// with P the periapsis direction scaled by a and Q the direction 90 degrees further along scaled
+// by b = a sqrt(1 - e^2), already in scene axes (y up). Kepler's equation M = E - e sin E is solved
+// with Danby's starting guess and Halley iterations, four orbits per AVX2 lane set. The iteration
+// count is fixed for the whole population, as many as its most eccentric orbit needs to be exact
+// to rounding, so there is no data-dependent branch.
+const double KEPLER_MAX_ECCENTRICITY = 0.99;
+
+int keplerIterations(double e)
+{
+    return e <= 0.1 ? 2 : e <= 0.8 ? 3 : e <= 0.95 ? 4 : 5;
+}
+
+struct KeplerOrbits
+{
+    std::vector<double> px, py, pz;  // a * periapsis direction
+    std::vector<double> qx, qy, qz;  // b * direction of motion at periapsis
+    std::vector<double> e, n, m0;    // eccentricity, mean motion (rad/day), mean anomaly at day 0
+    std::vector<int> satellites;     // orbits about another body rather than the Sun,
+    std::vector<int> satelliteParents; // whose position is added after solving
+    int iterations = 2;              // Halley iterations, for the most eccentric orbit
+    size_t unbound = 0;              // catalog bodies on open orbits, left where they started
+};
+
+KeplerOrbits keplerOrbits;
+
+size_t addKeplerOrbit(KeplerOrbits& orbits, const glm::dvec3& p, const glm::dvec3& q, double e, double n, double m0)
+{
+    orbits.px.push_back(p.x); orbits.py.push_back(p.y); orbits.pz.push_back(p.z);
+    orbits.qx.push_back(q.x); orbits.qy.push_back(q.y); orbits.qz.push_back(q.z);
+    orbits.e.push_back(e); orbits.n.push_back(n); orbits.m0.push_back(m0);
+    orbits.iterations = std::max(orbits.iterations, keplerIterations(e));
+    return orbits.e.size() - 1;
+}
+
+// Classical elements in the ecliptic frame (angles in radians), mu = G * (central + body mass)
+size_t addKeplerElements(KeplerOrbits& orbits, double a, double e, double inclination, double node,
+    double periapsis, double m0, double mu)
+{
+    e = std::min(std::max(e, 0.0), KEPLER_MAX_ECCENTRICITY);
+    double cw = std::cos(periapsis), sw = std::sin(periapsis), cn = std::cos(node), sn = std::sin(node);
+    double ci = std::cos(inclination), si = std::sin(inclination);
+    // Ecliptic x, y, z become scene x, -z, y
+    glm::dvec3 p(cw * cn - sw * sn * ci, sw * si, -(cw * sn + sw * cn * ci));
+    glm::dvec3 q(-sw * cn - cw * sn * ci, cw * si, -(-sw * sn + cw * cn * ci));
+    double b = a * std::sqrt(1.0 - e * e);
+    return addKeplerOrbit(orbits, p * a, q * b, e, a > 0.0 ? std::sqrt(mu / (a * a * a)) : 0.0, m0);
+}
+
+// Osculating orbit of a position and velocity (AU, AU/day, scene axes) about a central mass
+size_t addKeplerState(KeplerOrbits& orbits, const glm::dvec3& r, const glm::dvec3& v, double mu)
+{
+    double radius = glm::length(r);
+    double inverseA = 2.0 / radius - glm::dot(v, v) / mu;
+    glm::dvec3 h = glm::cross(r, v);
+    glm::dvec3 eccentricity = ((glm::dot(v, v) - mu / radius) * r - glm::dot(r, v) * v) / mu;
+    double e = glm::length(eccentricity);
+    if (radius <= 0.0 || inverseA <= 0.0 || glm::length(h) <= 0.0 || e > KEPLER_MAX_ECCENTRICITY)
+    {
+        orbits.unbound++;
+        return addKeplerOrbit(orbits, r, glm::dvec3(0.0), 0.0, 0.0, 0.0);
+    }
+    double a = 1.0 / inverseA, b = a * std::sqrt(1.0 - e * e);
+    glm::dvec3 pHat = e > 1e-12 ? eccentricity / e : r / radius; // any in-plane direction for a circle
+    glm::dvec3 qHat = glm::cross(glm::normalize(h), pHat);
+    double E0 = std::atan2(glm::dot(r, qHat) / b, glm::dot(r, pHat) / a + e);
+    return addKeplerOrbit(orbits, pHat * a, qHat * b, e, std::sqrt(mu * inverseA * inverseA * inverseA),
+        E0 - e * std::sin(E0));
+}
+
+#if defined(__AVX2__)
+// sin and cos of four angles of moderate size: quadrant by rounding to a multiple of pi/2 (three part
+// Cody-Waite), then the Cephes minimax polynomials on [-pi/4, pi/4]
+inline void sinCos4(__m256d x, __m256d& s, __m256d& c)
+{
+    const __m256d signBit = _mm256_set1_pd(-0.0), one = _mm256_set1_pd(1.0), two = _mm256_set1_pd(2.0);
+    __m256d q = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(0.63661977236758134308)),
+        _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256d r = _mm256_sub_pd(x, _mm256_mul_pd(q, _mm256_set1_pd(1.57079625129699707031)));
+    r = _mm256_sub_pd(r, _mm256_mul_pd(q, _mm256_set1_pd(7.54978941586159635335e-8)));
+    r = _mm256_sub_pd(r, _mm256_mul_pd(q, _mm256_set1_pd(5.39030285815811905290e-15)));
+    __m256d z = _mm256_mul_pd(r, r);
+
+    __m256d ps = _mm256_set1_pd(1.58962301576546568060e-10);
+    ps = _mm256_add_pd(_mm256_mul_pd(ps, z), _mm256_set1_pd(-2.50507477628578072866e-8));
+    ps = _mm256_add_pd(_mm256_mul_pd(ps, z), _mm256_set1_pd(2.75573136213857245213e-6));
+    ps = _mm256_add_pd(_mm256_mul_pd(ps, z), _mm256_set1_pd(-1.98412698295895385996e-4));
+    ps = _mm256_add_pd(_mm256_mul_pd(ps, z), _mm256_set1_pd(8.33333333332211858878e-3));
+    ps = _mm256_add_pd(_mm256_mul_pd(ps, z), _mm256_set1_pd(-1.66666666666666307295e-1));
+    __m256d sinR = _mm256_add_pd(r, _mm256_mul_pd(_mm256_mul_pd(r, z), ps));
+
+    __m256d pc = _mm256_set1_pd(-1.13585365213876817300e-11);
+    pc = _mm256_add_pd(_mm256_mul_pd(pc, z), _mm256_set1_pd(2.08757008419747316778e-9));
+    pc = _mm256_add_pd(_mm256_mul_pd(pc, z), _mm256_set1_pd(-2.75573141792967388112e-7));
+    pc = _mm256_add_pd(_mm256_mul_pd(pc, z), _mm256_set1_pd(2.48015872888517045348e-5));
+    pc = _mm256_add_pd(_mm256_mul_pd(pc, z), _mm256_set1_pd(-1.38888888888730564116e-3));
+    pc = _mm256_add_pd(_mm256_mul_pd(pc, z), _mm256_set1_pd(4.16666666666665929218e-2));
+    __m256d cosR = _mm256_add_pd(_mm256_sub_pd(one, _mm256_mul_pd(_mm256_set1_pd(0.5), z)),
+        _mm256_mul_pd(_mm256_mul_pd(z, z), pc));
+
+    // x = r + q pi/2: odd quadrants swap sin and cos, quadrants 2 and 3 negate sin, 1 and 2 negate cos
+    __m256d quadrant = _mm256_sub_pd(q, _mm256_mul_pd(_mm256_set1_pd(4.0), _mm256_floor_pd(_mm256_mul_pd(q, _mm256_set1_pd(0.25)))));
+    __m256d odd = _mm256_cmp_pd(_mm256_sub_pd(quadrant, _mm256_mul_pd(two, _mm256_floor_pd(_mm256_mul_pd(quadrant, _mm256_set1_pd(0.5))))), one, _CMP_EQ_OQ);
+    __m256d negateSin = _mm256_and_pd(_mm256_cmp_pd(quadrant, two, _CMP_GE_OQ), signBit);
+    __m256d negateCos = _mm256_and_pd(_mm256_or_pd(_mm256_cmp_pd(quadrant, one, _CMP_EQ_OQ),
+        _mm256_cmp_pd(quadrant, two, _CMP_EQ_OQ)), signBit);
+    s = _mm256_xor_pd(_mm256_blendv_pd(sinR, cosR, odd), negateSin);
+    c = _mm256_xor_pd(_mm256_blendv_pd(cosR, sinR, odd), negateCos);
+}
+#endif
+
+// Positions of orbits [begin, end) at the given day
+void propagateKeplerRange(const KeplerOrbits& orbits, double day, size_t begin, size_t end,
+    double* x, double* y, double* z)
+{
+    const double twoPi = 2.0 * 3.14159265358979323846;
+    const int iterations = orbits.iterations;
+    size_t i = begin;
+#if defined(__AVX2__)
+    const __m256d signBit = _mm256_set1_pd(-0.0), one = _mm256_set1_pd(1.0), half = _mm256_set1_pd(0.5);
+    const __m256d danby = _mm256_set1_pd(0.85), t = _mm256_set1_pd(day);
+    const __m256d period = _mm256_set1_pd(twoPi), inversePeriod = _mm256_set1_pd(1.0 / twoPi);
+    for (; i + 4 <= end; i += 4)
+    {
+        __m256d e = _mm256_loadu_pd(&orbits.e[i]);
+        __m256d M = _mm256_add_pd(_mm256_loadu_pd(&orbits.m0[i]), _mm256_mul_pd(_mm256_loadu_pd(&orbits.n[i]), t));
+        M = _mm256_sub_pd(M, _mm256_mul_pd(period, _mm256_round_pd(_mm256_mul_pd(M, inversePeriod),
+            _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)));
+        // Danby: E0 = M + 0.85 e sign(sin M), and sin M has the sign of M in [-pi, pi]
+        __m256d E = _mm256_add_pd(M, _mm256_or_pd(_mm256_mul_pd(danby, e), _mm256_and_pd(M, signBit)));
+        __m256d s = _mm256_setzero_pd(), c = s, d = s; // always set, iterations is at least 2
+        for (int k = 0; k < iterations; ++k)
+        {
+            sinCos4(E, s, c);
+            __m256d es = _mm256_mul_pd(e, s);
+            __m256d f = _mm256_sub_pd(_mm256_sub_pd(E, es), M);
+            __m256d df = _mm256_sub_pd(one, _mm256_mul_pd(e, c));
+            d = _mm256_div_pd(_mm256_mul_pd(f, df), _mm256_sub_pd(_mm256_mul_pd(df, df), _mm256_mul_pd(half, _mm256_mul_pd(f, es))));
+            E = _mm256_sub_pd(E, d);
+        }
+        // sin and cos of the final E from the last ones, second order in the (tiny) last step
+        __m256d halfD2 = _mm256_mul_pd(half, _mm256_mul_pd(d, d));
+        __m256d sNew = _mm256_sub_pd(s, _mm256_add_pd(_mm256_mul_pd(d, c), _mm256_mul_pd(halfD2, s)));
+        c = _mm256_sub_pd(_mm256_add_pd(c, _mm256_mul_pd(d, s)), _mm256_mul_pd(halfD2, c));
+        s = sNew;
+        __m256d u = _mm256_sub_pd(c, e);
+        _mm256_storeu_pd(x + i, _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(&orbits.px[i]), u), _mm256_mul_pd(_mm256_loadu_pd(&orbits.qx[i]), s)));
+        _mm256_storeu_pd(y + i, _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(&orbits.py[i]), u), _mm256_mul_pd(_mm256_loadu_pd(&orbits.qy[i]), s)));
+        _mm256_storeu_pd(z + i, _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(&orbits.pz[i]), u), _mm256_mul_pd(_mm256_loadu_pd(&orbits.qz[i]), s)));
+    }
+#endif
+    for (; i < end; ++i)
+    {
+        double e = orbits.e[i], M = orbits.m0[i] + orbits.n[i] * day;
+        M -= twoPi * std::nearbyint(M / twoPi);
+        double E = M + std::copysign(0.85 * e, M);
+        for (int k = 0; k < iterations; ++k)
+        {
+            double es = e * std::sin(E), f = E - es - M, df = 1.0 - e * std::cos(E);
+            E -= f * df / (df * df - 0.5 * f * es);
+        }
+        double s = std::sin(E), u = std::cos(E) - e;
+        x[i] = orbits.px[i] * u + orbits.qx[i] * s;
+        y[i] = orbits.py[i] * u + orbits.qy[i] * s;
+        z[i] = orbits.pz[i] * u + orbits.qz[i] * s;
+    }
+}
+
+void propagateKepler(const KeplerOrbits& orbits, double day, double* x, double* y, double* z)
+{
+    parallelFor(orbits.e.size(), 16384, [&](size_t begin, size_t end) {
+        propagateKeplerRange(orbits, day, begin, end, x, y, z);
+    });
+    for (size_t k = 0; k < orbits.satellites.size(); ++k)
+    {
+        int body = orbits.satellites[k], parent = orbits.satelliteParents[k];
+        x[body] += x[parent];
+        y[body] += y[parent];
+        z[body] += z[parent];
+    }
+}
+
+// Sun, Earth and Moon on their mean J2000 orbits, the generated belt on random ones and any scene
+// catalog converted from its state vectors, laid out like the N-body system so the renderer reads
+// positions from the same arrays
+void buildSolarSystemKepler(int asteroidCount, const BodyCatalog& catalog)
+{
+    const double degrees = 3.14159265358979323846 / 180.0;
+    const double earthMass = 3.0034896e-6, moonMass = 3.6943e-8, G = GAUSSIAN_GRAVITY;
+    keplerOrbits = KeplerOrbits();
+    size_t total = 3 + (size_t)std::max(0, asteroidCount) + catalog.count;
+    for (std::vector<double>* v : { &keplerOrbits.px, &keplerOrbits.py, &keplerOrbits.pz, &keplerOrbits.qx,
+        &keplerOrbits.qy, &keplerOrbits.qz, &keplerOrbits.e, &keplerOrbits.n, &keplerOrbits.m0 })
+        v->reserve(total);
+
+    nbodySun = (int)addKeplerOrbit(keplerOrbits, glm::dvec3(0.0), glm::dvec3(0.0), 0.0, 0.0, 0.0);
+    nbodyEarth = (int)addKeplerElements(keplerOrbits, 1.00000261, 0.01671123, 0.0, 0.0, 102.93768 * degrees,
+        357.52911 * degrees, G * (1.0 + earthMass + moonMass));
+    nbodyMoon = (int)addKeplerElements(keplerOrbits, EARTH_MOON_DISTANCE, 0.0549, 5.145 * degrees, 125.08 * degrees,
+        318.15 * degrees, 134.96 * degrees, G * (earthMass + moonMass));
+    keplerOrbits.satellites.push_back(nbodyMoon);
+    keplerOrbits.satelliteParents.push_back(nbodyEarth);
+
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<double> radius(2.1, 3.3), eccentricity(0.0, 0.3), angle(0.0, 360.0 * degrees);
+    std::normal_distribution<double> inclination(0.0, 8.0 * degrees);
+    nbodyFirstAsteroid = (int)keplerOrbits.e.size();
+    for (int i = 0; i < asteroidCount; ++i)
+    {
+        double a = radius(rng), e = eccentricity(rng), tilt = std::fabs(inclination(rng));
+        double node = angle(rng), periapsis = angle(rng), m0 = angle(rng);
+        addKeplerElements(keplerOrbits, a, e, tilt, node, periapsis, m0, G);
+    }
+    for (size_t i = 0; i < catalog.count; ++i)
+        addKeplerState(keplerOrbits,
+            glm::dvec3(catalog.columns[COLUMN_X][i], catalog.columns[COLUMN_Y][i], catalog.columns[COLUMN_Z][i]),
+            glm::dvec3(catalog.columns[COLUMN_VX][i], catalog.columns[COLUMN_VY][i], catalog.columns[COLUMN_VZ][i]),
+            G * (1.0 + catalog.columns[COLUMN_MASS][i]));
+
+    // The renderer reads positions (and counts bodies) from the N-body arrays
+    nbody = NBodySystem();
+    nbody.x.resize(total); nbody.y.resize(total); nbody.z.resize(total);
+    nbody.mass.assign(total, 1e-12);
+    nbody.mass[nbodySun] = 1.0;
+    nbody.mass[nbodyEarth] = earthMass;
+    nbody.mass[nbodyMoon] = moonMass;
+    propagateKepler(keplerOrbits, 0.0, nbody.x.data(), nbody.y.data(), nbody.z.data());
+}
+
+// Block compression
+// LZ77 in the style of LZ4, for recordings. A hash of the next four bytes finds where they were
+// last seen within 64 KB, and the output alternates runs of literals with (offset, length)
+// matches: a token byte holds both lengths (15 means more follow, in bytes up to 255), then the
+// literals, then a two byte offset. The last sequence is literals only. Matches are at least four
+// bytes and the decoder checks every length and offset, so a corrupt block fails instead of
+// writing out of bounds.
+const int LZ_HASH_BITS = 16;
+const size_t LZ_MIN_MATCH = 4, LZ_MAX_OFFSET = 65535;
+
+void lzPutLength(std::vector<unsigned char>& out, size_t length)
+{
+    for (; length >= 255; length -= 255)
+        out.push_back(255);
+    out.push_back((unsigned char)length);
+}
+
+void lzPutSequence(std::vector<unsigned char>& out, const unsigned char* literals, size_t literalCount,
+    size_t offset, size_t matchLength)
+{
+    size_t extra = matchLength ? matchLength - LZ_MIN_MATCH : 0;
+    out.push_back((unsigned char)((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(extra, 15)));
+    if (literalCount >= 15)
+        lzPutLength(out, literalCount - 15);
+    out.insert(out.end(), literals, literals + literalCount);
+    if (!matchLength)
+        return;
+    out.push_back((unsigned char)(offset & 255));
+    out.push_back((unsigned char)(offset >> 8));
+    if (extra >= 15)
+        lzPutLength(out, extra - 15);
+}
+
+// Appends the compressed form of data to out
+void lzCompress(const unsigned char* data, size_t size, std::vector<unsigned char>& out, std::vector<uint32_t>& table)
+{
+    table.assign((size_t)1 << LZ_HASH_BITS, 0); // position + 1, 0 for none
+    size_t anchor = 0, i = 0;
+    while (i + 8 <= size)
+    {
+        uint32_t word, seen;
+        std::memcpy(&word, data + i, 4);
+        uint32_t hash = (word * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t candidate = table[hash];
+        table[hash] = (uint32_t)(i + 1);
+        if (candidate == 0 || i - (candidate - 1) > LZ_MAX_OFFSET ||
+            (std::memcpy(&seen, data + candidate - 1, 4), seen != word))
+        {
+            i += 1 + ((i - anchor) >> 6); // skip faster through data that does not compress
+            continue;
+        }
+        size_t from = candidate - 1, length = LZ_MIN_MATCH;
+        while (i + length < size && data[from + length] == data[i + length])
+            ++length;
+        lzPutSequence(out, data + anchor, i - anchor, i - from, length);
+        i += length;
+        anchor = i;
+    }
+    lzPutSequence(out, data + anchor, size - anchor, 0, 0);
+}
+
+bool lzGetLength(const unsigned char*& in, const unsigned char* end, size_t& length)
+{
+    unsigned char byte;
+    do
+    {
+        if (in >= end)
+            return false;
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Decompresses exactly outSize bytes, false if the input is malformed or the size does not match
+bool lzDecompress(const unsigned char* in, size_t size, unsigned char* out, size_t outSize)
+{
+    const unsigned char* end = in + size;
+    size_t written = 0;
+    while (in < end)
+    {
+        unsigned char token = *in++;
+        size_t literals = token >> 4, length = token & 15;
+        if (literals == 15 && !lzGetLength(in, end, literals))
+            return false;
+        if (literals > (size_t)(end - in) || literals > outSize - written)
+            return false;
+        std::memcpy(out + written, in, literals);
+        in += literals;
+        written += literals;
+        if (in == end) // the last sequence has no match
+            break;
+        if (end - in < 2)
+            return false;
+        size_t offset = in[0] | ((size_t)in[1] << 8);
+        in += 2;
+        if (length == 15 && !lzGetLength(in, end, length))
+            return false;
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > written || length > outSize - written)
+            return false;
+        unsigned char* to = out + written;
+        if (offset >= length)
+            std::memcpy(to, to - offset, length);
+        else
+            for (size_t k = 0; k < length; ++k) // overlapping, repeats the last offset bytes
+                to[k] = to[k - offset];
+        written += length;
+    }
+    return written == outSize;
+}
+
+// Recordings
+// Every body's position at every step of a run, stored compactly so a long or expensive
+// simulation is computed once and replayed as often as needed. Orientations are functions of the
+// day and are not stored. Positions are quantised to RECORDING_QUANTUM AU and steps are grouped
+// in blocks of keyframeInterval: a block starts with a keyframe of absolute values, and every
+// later step stores each coordinate's distance from its prediction out of the steps before it,
+// linear (two steps) or quadratic (three), which along an orbit is a few units. A step is all x,
+// then all y, then all z, cut into groups of RECORDING_GROUP values; each group is one byte with
+// the predictor and the bit width, then its zigzag values packed at that width. Interpolated
+// N-body states suit the linear predictor and smooth ones the quadratic, so the encoder takes
+// whichever packs smaller per group. Each block is then compressed with the LZ77 above. A keyframe
+// index at the end of the file lets replay seek to any step by decompressing one block and
+// decoding at most keyframeInterval - 1 steps of deltas. Packed residuals leave LZ little to find
+// along orbits, so a block it does not shrink is stored as it is; it pays off on runs, such as
+// bodies at rest.
+//
+// Layout (little-endian): RecordingHeader, double mass[bodyCount], the compressed blocks, then
+// RecordingBlock index[blockCount] at indexOffset.
+const char RECORDING_MAGIC[8] = { 'S', 'S', 'R', 'E', 'C', 'R', 'D', '\0' };
+const uint32_t RECORDING_VERSION = 1;
+const double RECORDING_QUANTUM = 1.0 / (1 << 30); // AU, about 140 m
+
+struct RecordingHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t bodyCount;
+    uint32_t firstAsteroid;
+    uint32_t keyframeInterval; // steps per block
+    uint64_t stepCount;
+    uint64_t indexOffset;
+    double startDay;
+    double stepDays;
+    double quantum;            // AU per unit
+};
+
+struct RecordingBlock
+{
+    uint64_t offset;           // from the start of the file
+    uint64_t compressedBytes;  // equal to rawBytes for a block stored uncompressed
+    uint64_t rawBytes;
+};
+
+const size_t RECORDING_GROUP = 16;
+const unsigned char RECORDING_QUADRATIC = 128; // group byte flag, the rest is the bit width
+
+inline uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+inline int bitWidth(uint64_t value)
+{
+    int width = 0;
+    while (width < 64 && (value >> width) != 0)
+        ++width;
+    return width;
+}
+
+// Predicted value of coordinate i from the steps before, order 0 (none) to 2 (quadratic)
+inline int64_t predictCoordinate(int order, const std::vector<int64_t>& last, const std::vector<int64_t>& older,
+    const std::vector<int64_t>& oldest, size_t i)
+{
+    if (order == 0)
+        return 0;
+    if (order == 1)
+        return last[i];
+    if (order == 2)
+        return 2 * last[i] - older[i];
+    return 3 * (last[i] - older[i]) + oldest[i];
+}
+
+void packBits(std::vector<unsigned char>& out, const uint64_t* values, size_t count, int width)
+{
+    uint64_t pending = 0;
+    int bits = 0;
+    for (size_t k = 0; k < count; ++k)
+    {
+        uint64_t value = values[k];
+        for (int left = width; left > 0; )
+        {
+            int take = std::min(left, 8 - bits);
+            pending |= (value & ((1ull << take) - 1)) << bits;
+            value >>= take;
+            bits += take;
+            left -= take;
+            if (bits == 8)
+            {
+                out.push_back((unsigned char)pending);
+                pending = 0;
+                bits = 0;
+            }
+        }
+    }
+    if (bits)
+        out.push_back((unsigned char)pending);
+}
+
+bool unpackBits(const unsigned char*& p, const unsigned char* end, uint64_t* values, size_t count, int width)
+{
+    if ((size_t)(end - p) < (count * width + 7) / 8)
+        return false;
+    uint64_t pending = 0;
+    int bits = 0;
+    for (size_t k = 0; k < count; ++k)
+    {
+        uint64_t value = 0;
+        for (int got = 0; got < width; )
+        {
+            if (bits == 0)
+            {
+                pending = *p++;
+                bits = 8;
+            }
+            int take = std::min(width - got, bits);
+            value |= (pending & ((1ull << take) - 1)) << got;
+            pending >>= take;
+            bits -= take;
+            got += take;
+        }
+        values[k] = value;
+    }
+    return true;
+}
+
+struct RecordingWriter
+{
+    std::ofstream file;
+    RecordingHeader header = {};
+    std::vector<RecordingBlock> blocks;
+    std::vector<int64_t> current, last, older, oldest; // quantised, this step and the three before
+    std::vector<unsigned char> raw, compressed;
+    std::vector<uint32_t> hashTable;
+    uint64_t offset = 0;
+};
+
+bool beginRecording(RecordingWriter& writer, const std::string& path, const std::vector<double>& masses,
+    int firstAsteroid, double startDay, double stepDays, int keyframeInterval)
+{
+    RecordingHeader& header = writer.header;
+    header = RecordingHeader();
+    memcpy(header.magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+    header.version = RECORDING_VERSION;
+    header.bodyCount = (uint32_t)masses.size();
+    header.firstAsteroid = (uint32_t)firstAsteroid;
+    header.keyframeInterval = (uint32_t)keyframeInterval;
+    header.startDay = startDay;
+    header.stepDays = stepDays;
+    header.quantum = RECORDING_QUANTUM;
+
+    writer.file.open(path, std::ios::binary);
+    if (!writer.file)
+    {
+        std::cout << "Cannot write recording " << path << std::endl;
+        return false;
+    }
+    writer.file.write((const char*)&header, sizeof(header)); // rewritten with the counts at the end
+    writer.file.write((const char*)masses.data(), masses.size() * sizeof(double));
+    writer.offset = sizeof(header) + masses.size() * sizeof(double);
+    writer.current.assign(masses.size() * 3, 0);
+    writer.last = writer.older = writer.oldest = writer.current;
+    return true;
+}
+
+void flushRecordingBlock(RecordingWriter& writer)
+{
+    if (writer.raw.empty())
+        return;
+    writer.compressed.clear();
+    lzCompress(writer.raw.data(), writer.raw.size(), writer.compressed, writer.hashTable);
+    const std::vector<unsigned char>& stored = writer.compressed.size() < writer.raw.size() ? writer.compressed : writer.raw;
+    writer.file.write((const char*)stored.data(), stored.size());
+    writer.blocks.push_back({ writer.offset, stored.size(), writer.raw.size() });
+    writer.offset += stored.size();
+    writer.raw.clear();
+}
+
+// Appends one step; positions holds every body's x, then every y, then every z, in AU
+void recordStep(RecordingWriter& writer, const double* positions)
+{
+    uint64_t inBlock = writer.header.stepCount++ % writer.header.keyframeInterval;
+    int linear = (int)std::min<uint64_t>(inBlock, 2), quadratic = (int)std::min<uint64_t>(inBlock, 3);
+    double scale = 1.0 / writer.header.quantum;
+    size_t count = writer.current.size();
+    for (size_t i = 0; i < count; ++i)
+        writer.current[i] = llround(positions[i] * scale);
+
+    uint64_t linearValues[RECORDING_GROUP], quadraticValues[RECORDING_GROUP];
+    for (size_t group = 0; group < count; group += RECORDING_GROUP)
+    {
+        size_t n = std::min(RECORDING_GROUP, count - group);
+        uint64_t linearBits = 0, quadraticBits = 0;
+        for (size_t k = 0; k < n; ++k)
+        {
+            size_t i = group + k;
+            linearValues[k] = zigzag(writer.current[i] - predictCoordinate(linear, writer.last, writer.older, writer.oldest, i));
+            quadraticValues[k] = zigzag(writer.current[i] - predictCoordinate(quadratic, writer.last, writer.older, writer.oldest, i));
+            linearBits |= linearValues[k];
+            quadraticBits |= quadraticValues[k];
+        }
+        bool useQuadratic = quadratic > linear && bitWidth(quadraticBits) < bitWidth(linearBits);
+        int width = bitWidth(useQuadratic ? quadraticBits : linearBits);
+        writer.raw.push_back((unsigned char)(width | (useQuadratic ? RECORDING_QUADRATIC : 0)));
+        packBits(writer.raw, useQuadratic ? quadraticValues : linearValues, n, width);
+    }
+    writer.oldest.swap(writer.older);
+    writer.older.swap(writer.last);
+    writer.last.swap(writer.current);
+    if (inBlock + 1 == writer.header.keyframeInterval)
+        flushRecordingBlock(writer);
+}
+
+bool finishRecording(RecordingWriter& writer)
+{
+    flushRecordingBlock(writer);
+    writer.header.indexOffset = writer.offset;
+    writer.file.write((const char*)writer.blocks.data(), writer.blocks.size() * sizeof(RecordingBlock));
+    writer.file.seekp(0);
+    writer.file.write((const char*)&writer.header, sizeof(writer.header));
+    writer.file.close();
+    return !writer.file.fail();
+}
+
+struct Recording
+{
+    MappedFile file;
+    const RecordingHeader* header = nullptr;
+    const double* masses = nullptr;
+    const RecordingBlock* blocks = nullptr;
+    uint64_t blockCount = 0;
+
+    // Decoder: the current block decompressed, and the last two steps decoded from it
+    uint64_t block = UINT64_MAX;
+    std::vector<unsigned char> raw;
+    const unsigned char* cursor = nullptr;
+    uint64_t step = 0;                // the step in last
+    std::vector<int64_t> current, last, older, oldest;
+    uint64_t loadedStep = UINT64_MAX; // the step in the N-body arrays' previous positions
+    bool failed = false;
+};
+
+Recording recording;
+
+uint64_t recordingBlockCount(const RecordingHeader& header)
+{
+    return (header.stepCount + header.keyframeInterval - 1) / header.keyframeInterval;
+}
+
+double recordingEndDay(const RecordingHeader& header)
+{
+    return header.startDay + (header.stepCount - 1) * header.stepDays;
+}
+
+bool openRecording(const std::string& path, Recording& rec)
+{
+    if (!openMappedFile(path, rec.file))
+    {
+        std::cout << "Cannot open recording " << path << std::endl;
+        return false;
+    }
+    // The Sun, Earth and Moon are always bodies 0, 1 and 2 (see loadRecordingBodies)
+    const RecordingHeader* header = (const RecordingHeader*)rec.file.data;
+    bool valid = rec.file.size >= sizeof(RecordingHeader) &&
+        memcmp(header->magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) == 0 &&
+        header->version == RECORDING_VERSION && header->bodyCount >= 3 && header->stepCount > 0 &&
+        header->keyframeInterval > 0 && header->stepDays > 0.0 && header->quantum > 0.0 &&
+        header->firstAsteroid <= header->bodyCount;
+    uint64_t blockCount = valid ? recordingBlockCount(*header) : 0;
+    if (valid)
+    {
+        size_t blocksStart = sizeof(RecordingHeader) + header->bodyCount * sizeof(double);
+        valid = header->indexOffset >= blocksStart && header->indexOffset <= rec.file.size &&
+            blockCount == (rec.file.size - header->indexOffset) / sizeof(RecordingBlock) &&
+            rec.file.size == header->indexOffset + blockCount * sizeof(RecordingBlock);
+        const RecordingBlock* blocks = valid ? (const RecordingBlock*)(rec.file.data + header->indexOffset) : nullptr;
+        // A step is at most 8 bytes per coordinate plus a width byte and a partial byte per
+        // group, and the writer only keeps a compressed block when it is smaller, so a corrupt
+        // index cannot size the decode buffer past what its steps could hold
+        uint64_t coordinates = (uint64_t)header->bodyCount * 3;
+        uint64_t maxStepBytes = coordinates * 8 + (coordinates + RECORDING_GROUP - 1) / RECORDING_GROUP * 2;
+        for (uint64_t b = 0; valid && b < blockCount; ++b)
+        {
+            uint64_t steps = std::min<uint64_t>(header->keyframeInterval, header->stepCount - b * header->keyframeInterval);
+            valid = blocks[b].offset >= blocksStart && blocks[b].offset <= header->indexOffset &&
+                blocks[b].compressedBytes <= header->indexOffset - blocks[b].offset &&
+                blocks[b].compressedBytes <= blocks[b].rawBytes && blocks[b].rawBytes / steps <= maxStepBytes;
+        }
+    }
+    if (!valid)
+    {
+        std::cout << "Not a version " << RECORDING_VERSION << " recording: " << path << std::endl;
+        closeMappedFile(rec.file);
+        return false;
+    }
+    rec.header = header;
+    rec.masses = (const double*)(rec.file.data + sizeof(RecordingHeader));
+    rec.blocks = (const RecordingBlock*)(rec.file.data + header->indexOffset);
+    rec.blockCount = blockCount;
+    rec.current.assign((size_t)header->bodyCount * 3, 0);
+    rec.last = rec.older = rec.oldest = rec.current;
+    return true;
+}
+
+void closeRecording(Recording& rec)
+{
+    closeMappedFile(rec.file);
+    rec = Recording();
+}
+
+// Decodes the step after rec.step (or the keyframe, first in a block) into rec.last
+bool decodeRecordingStep(Recording& rec, uint64_t inBlock)
+{
+    const unsigned char* end = rec.raw.data() + rec.raw.size();
+    int linear = (int)std::min<uint64_t>(inBlock, 2), quadratic = (int)std::min<uint64_t>(inBlock, 3);
+    size_t count = rec.current.size();
+    uint64_t values[RECORDING_GROUP];
+    for (size_t group = 0; group < count; group += RECORDING_GROUP)
+    {
+        size_t n = std::min(RECORDING_GROUP, count - group);
+        if (rec.cursor >= end)
+            return false;
+        unsigned char flags = *rec.cursor++;
+        int width = flags & ~RECORDING_QUADRATIC, order = (flags & RECORDING_QUADRATIC) ? quadratic : linear;
+        if (width > 64 || !unpackBits(rec.cursor, end, values, n, width))
+            return false;
+        for (size_t k = 0; k < n; ++k)
+            rec.current[group + k] = predictCoordinate(order, rec.last, rec.older, rec.oldest, group + k) + unzigzag(values[k]);
+    }
+    rec.oldest.swap(rec.older);
+    rec.older.swap(rec.last);
+    rec.last.swap(rec.current);
+    return true;
+}
+
+// Brings rec.last to the given step: forwards from the current one when it can, otherwise from
+// the keyframe of the step's block
+bool seekRecording(Recording& rec, uint64_t step)
+{
+    const RecordingHeader& header = *rec.header;
+    uint64_t block = step / header.keyframeInterval, first = block * header.keyframeInterval;
+    if (block != rec.block || step < rec.step)
+    {
+        if (block != rec.block)
+        {
+            const RecordingBlock& stored = rec.blocks[block];
+            rec.block = UINT64_MAX;
+            rec.raw.resize(stored.rawBytes);
+            if (stored.compressedBytes == stored.rawBytes)
+                std::memcpy(rec.raw.data(), rec.file.data + stored.offset, stored.rawBytes);
+            else if (!lzDecompress(rec.file.data + stored.offset, stored.compressedBytes, rec.raw.data(), rec.raw.size()))
+                return false;
+            rec.block = block;
+        }
+        rec.cursor = rec.raw.data();
+        rec.step = first;
+        if (!decodeRecordingStep(rec, 0))
+            return false;
+    }
+    while (rec.step < step)
+    {
+        rec.step++;
+        if (!decodeRecordingStep(rec, rec.step - first))
+            return false;
+    }
+    return true;
+}
+
+void dequantise(const Recording& rec, std::vector<double>& x, std::vector<double>& y, std::vector<double>& z)
+{
+    size_t count = rec.header->bodyCount;
+    double quantum = rec.header->quantum;
+    for (size_t i = 0; i < count; ++i)
+    {
+        x[i] = rec.last[i] * quantum;
+        y[i] = rec.last[count + i] * quantum;
+        z[i] = rec.last[2 * count + i] * quantum;
+    }
+}
+
+// Puts the recorded steps either side of the day in the system's previous and current positions
+// and returns the blend between them, clamped to the recording. Playing forwards decodes one new
+// step per step crossed.
+double evaluateRecording(Recording& rec, double day, NBodySystem& system)
+{
+    const RecordingHeader& header = *rec.header;
+    double t = std::min(std::max((day - header.startDay) / header.stepDays, 0.0), (double)(header.stepCount - 1));
+    uint64_t step = std::min((uint64_t)t, header.stepCount - 1), next = std::min(step + 1, header.stepCount - 1);
+    if (step != rec.loadedStep && !rec.failed)
+    {
+        bool ok = true;
+        if (rec.loadedStep != UINT64_MAX && step == rec.loadedStep + 1 && rec.step == step)
+        {
+            system.px.swap(system.x);
+            system.py.swap(system.y);
+            system.pz.swap(system.z);
+        }
+        else
+        {
+            ok = seekRecording(rec, step);
+            if (ok)
+                dequantise(rec, system.px, system.py, system.pz);
+        }
+        ok = ok && seekRecording(rec, next);
+        if (ok)
+            dequantise(rec, system.x, system.y, system.z);
+        else
+        {
+            std::cout << "Recording block " << step / header.keyframeInterval << " is corrupt" << std::endl;
+            rec.failed = true;
+            rec.block = UINT64_MAX;
+        }
+        rec.loadedStep = step;
+    }
+    return t - step;
+}
+
+// Stands the N-body arrays up as the recording's bodies, like loadEphemerisBodies
+bool loadRecordingBodies(const std::string& path)
+{
+    closeRecording(recording);
+    if (!openRecording(path, recording))
+        return false;
+    const RecordingHeader& header = *recording.header;
+    nbody = NBodySystem();
+    for (uint32_t body = 0; body < header.bodyCount; ++body)
+        addBody(nbody, glm::dvec3(0.0, 0.0, 0.0), glm::dvec3(0.0, 0.0, 0.0), recording.masses[body]);
+    nbody.px = nbody.x;
+    nbody.py = nbody.y;
+    nbody.pz = nbody.z;
+    nbodySun = 0;
+    nbodyEarth = 1;
+    nbodyMoon = 2;
+    nbodyFirstAsteroid = (int)header.firstAsteroid;
+    return true;
+}
+
+// Simulation clock
+// The window's clock runs at BASE_DAYS_PER_SECOND of real time times the warp factor, whatever the
+// frame rate. N-body physics follows it in fixed steps and the frame interpolates between the last
+// two states. Stepping per frame is capped by a time budget, so at high warp the simulation falls
+// behind the requested rate instead of dragging the frame rate down. Analytic orbits are closed
+// form and follow any warp exactly.
+const double BASE_DAYS_PER_SECOND = 60.0 / 96.0; // the assignment's 1/96 day per frame at 60 Hz
+const double MIN_WARP = 1.0, MAX_WARP = 1e6;
+const double MAX_FRAME_SECONDS = 0.25;           // longer hitches are not caught up
+const double SIMULATION_BUDGET_SECONDS = 0.008;
+
+struct SimulationClock
+{
+    double day = 0.0;
+    double warp = 1.0;
+    bool saturated = false; // the last frame could not simulate all of the warped time
+};
+
+SimulationClock simulationClock;
+
+void tickSimulationClock(SimulationClock& clock, double realSeconds)
+{
+    clock.day += std::min(realSeconds, MAX_FRAME_SECONDS) * BASE_DAYS_PER_SECOND * clock.warp;
+}
+
+// Brings the physics up to the clock within the budget, pulling the clock back if it runs out
+void syncSimulation(SimulationClock& clock, double budgetSeconds)
+{
+    clock.saturated = false;
+    if (physicsMode != PhysicsMode::NBody)
+        return;
+    ProfileScope simulationZone(ZONE_SIMULATION);
+    if (!advanceNBody(nbody, clock.day, budgetSeconds))
+    {
+        clock.day = nbody.time;
+        clock.saturated = true;
+    }
+}
+
+void setWarp(SimulationClock& clock, double warp)
+{
+    clock.warp = std::min(std::max(warp, MIN_WARP), MAX_WARP);
+}
+
+// Pipelined simulation
+// With N-body physics the stepping runs on its own thread. It works towards the day the renderer
+// last asked for and publishes each state through a triple buffer, so drawing one frame overlaps
+// simulating the next and a frame costs max(simulation, render) rather than their sum.
+const double SIMULATION_SLICE_SECONDS = 0.004; // longest stretch of stepping between snapshots
+
+struct SimulationThread
+{
+    std::thread thread;
+    std::atomic<bool> running{ false };
+    std::atomic<double> requestedDay{ 0.0 };
+    TripleBuffer<WorldSnapshot> snapshots;
+};
+
+SimulationThread simulationThread;
+
+// Owns nbody while running; publishes at least every slice so the renderer sees progress even
+// when it asks for more than the thread can simulate
+void simulationThreadLoop(SimulationThread& sim)
+{
+    while (sim.running.load(std::memory_order_acquire))
+    {
+        double day = sim.requestedDay.load(std::memory_order_acquire);
+        if (nbody.time >= day - 1e-9)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+        advanceNBody(nbody, day, SIMULATION_SLICE_SECONDS);
+        takeSnapshot(sim.snapshots.writeSlot(), nbody);
+        sim.snapshots.publish();
+    }
+}
+
+// Hands nbody to the thread; until stopSimulationThread the renderer only reads snapshots
+void startSimulationThread(SimulationThread& sim, double day)
+{
+    advanceNBody(nbody, nbody.time); // fills the previous state
+    takeSnapshot(sim.snapshots.writeSlot(), nbody);
+    sim.snapshots.publish();
+    sim.snapshots.update();
+    renderSnapshot = &sim.snapshots.readSlot();
+    sim.requestedDay.store(day);
+    sim.running.store(true);
+    sim.thread = std::thread(simulationThreadLoop, std::ref(sim));
+}
+
+void stopSimulationThread(SimulationThread& sim)
+{
+    if (!sim.running.exchange(false))
+        return;
+    sim.thread.join();
+    renderSnapshot = nullptr;
+}
+
+// The pipelined syncSimulation: takes the newest snapshot, pulls the clock back if the thread has
+// fallen behind it, and asks for the day the next frame is expected to show
+void syncPipelinedSimulation(SimulationThread& sim, SimulationClock& clock, double lookaheadDays)
+{
+    ProfileScope simulationZone(ZONE_SIMULATION);
+    sim.snapshots.update();
+    renderSnapshot = &sim.snapshots.readSlot();
+    clock.saturated = renderSnapshot->time < clock.day - 1e-9;
+    if (clock.saturated)
+        clock.day = renderSnapshot->time;
+    sim.requestedDay.store(clock.day + lookaheadDays, std::memory_order_release);
+}
+
+// Waits until the thread has reached the day, for headless frames that must land on it exactly
+void waitForSimulation(SimulationThread& sim, double day)
+{
+    ProfileScope simulationZone(ZONE_SIMULATION);
+    while (sim.snapshots.readSlot().time < day - 1e-9)
+    {
+        if (!sim.snapshots.update())
+            std::this_thread::yield();
+    }
+    renderSnapshot = &sim.snapshots.readSlot();
+}
+
+// Brings the body positions (nbodyInterpolated) to the day in every mode but analytic
+void updateBodyPositions(double day)
+{
+    ProfileScope simulationZone(ZONE_SIMULATION);
+    if (physicsMode == PhysicsMode::Ephemeris)
+    {
+        evaluateEphemeris(ephemeris, day, nbody.x.data(), nbody.y.data(), nbody.z.data());
+        nbodyAlpha = 1.0;
+    }
+    else if (physicsMode == PhysicsMode::Kepler)
+    {
+        propagateKepler(keplerOrbits, day, nbody.x.data(), nbody.y.data(), nbody.z.data());
+        nbodyAlpha = 1.0;
+    }
+    else if (physicsMode == PhysicsMode::Replay)
+        nbodyAlpha = evaluateRecording(recording, day, nbody);
+    else if (renderSnapshot)
+        nbodyAlpha = blendFactor(renderSnapshot->previousTime, renderSnapshot->time, day);
+    else
+    {
+        advanceNBody(nbody, day);
+        nbodyAlpha = nbodyInterpolation(nbody, day);
+    }
+}
+
+void updateSolarSystemTransforms(double day)
+{
+    ProfileScope transformsZone(ZONE_TRANSFORMS);
+    const glm::vec3 up(0.0f, 1.0f, 0.0f);
+
+    setLocalTransform(sceneGraph, sunBodyNode,
+        glm::rotate(glm::mat4(1.0f), glm::radians(get_sun_rotate_angle_around_itself(day)), up));
+
+    if (physicsMode != PhysicsMode::Analytic)
+    {
+        updateBodyPositions(day);
+        setLocalTransform(sceneGraph, sunNode, glm::translate(glm::mat4(1.0f), nbodyPosition(nbodySun) * (float)scene.earthOrbitRadius));
+        setLocalTransform(sceneGraph, earthNode, glm::translate(glm::mat4(1.0f), nbodyOffset(nbodySun, nbodyEarth, scene.earthOrbitRadius)));
+        setLocalTransform(sceneGraph, moonNode, glm::translate(glm::mat4(1.0f), nbodyOffset(nbodyEarth, nbodyMoon, nbodyMoonScale())));
+    }
+    else
+    {
+        glm::mat4 earth = glm::rotate(glm::mat4(1.0f), glm::radians(get_earth_rotate_angle_around_sun(day)), up);
+        setLocalTransform(sceneGraph, earthNode, glm::translate(earth, glm::vec3((float)scene.earthOrbitRadius, 0.0f, 0.0f)));
+        glm::mat4 moon = glm::rotate(glm::mat4(1.0f), glm::radians(get_moon_rotate_angle_around_earth(day)), up);
+        setLocalTransform(sceneGraph, moonNode, glm::translate(moon, glm::vec3((float)scene.moonOrbitRadius, 0.0f, 0.0f)));
+    }
+
+    glm::mat4 earthBody = glm::rotate(glm::mat4(1.0f), glm::radians((float)scene.earthTiltDegrees), glm::vec3(0.0f, 0.0f, 1.0f));
+    setLocalTransform(sceneGraph, earthBodyNode,
+        glm::rotate(earthBody, glm::radians(get_earth_rotate_angle_around_itself(day)), up));
+
+    setLocalTransform(sceneGraph, moonBodyNode,
+        glm::rotate(glm::mat4(1.0f), glm::radians(get_moon_rotate_angle_around_itself(day)), up));
+
+    updateWorldTransforms(sceneGraph);
+}
+
+// Shader
+// One source for both programs: the scene, and with TRAILS defined the orbit trails (see Orbit trails)
+const char* vertexShaderSource = R"(
+    #version 330 core
+    layout (std140) uniform Camera {
+        mat4 view;
+        mat4 projection;
+    };
+
+#ifdef TRAILS
+    uniform samplerBuffer trailPositions;         // x, y, z per body, one slot after another
+    uniform int trailHead, trailCapacity, trailBodies, trailFilled;
+
+    out vec4 vertexColor;
+
+    // Sun, Earth, Moon, then every asteroid
+    const vec3 trailColors[4] = vec3[4](vec3(1.0, 0.8, 0.3), vec3(0.3, 0.6, 1.0), vec3(0.8, 0.8, 0.8), vec3(0.7, 0.65, 0.55));
+
+    void main(){
+       // Vertex i of a strip is the sample i slots older than the newest
+       int slot = (trailHead - gl_VertexID + trailCapacity) % trailCapacity;
+       int texel = (slot * trailBodies + gl_InstanceID) * 3;
+       vec3 position = vec3(texelFetch(trailPositions, texel).r, texelFetch(trailPositions, texel + 1).r,
+           texelFetch(trailPositions, texel + 2).r);
+       gl_Position = projection * view * vec4(position, 1.0);
+       float fade = 1.0 - float(gl_VertexID) / float(trailFilled);
+       vertexColor = vec4(trailColors[min(gl_InstanceID, 3)], fade * fade);
+     }
+#else
+    layout (location = 0) in vec3 aPos;           // snorm16, twice the unit size mesh
+    layout (location = 1) in vec3 aColor;         // unorm8
+    layout (location = 2) in mat4 aModel;        // per instance, locations 2 to 5
+    layout (location = 6) in vec4 aInstanceColor; // per instance, unorm8
+
+    out vec3 vertexColor;
+
+    void main(){
+       gl_Position = projection * view * aModel * vec4(aPos * 0.5, 1.0);
+       vertexColor = aColor * aInstanceColor.rgb;
+     }
+#endif
+
+)";
+
+const char* fragmentShaderSource = R"(
+    #version 330 core 
+    out vec4 FragColor;
+#ifdef TRAILS
+    in vec4 vertexColor;
+
+    void main(){
+        FragColor = vertexColor;
+    }
+#else
+    in vec3 vertexColor;
+
+    void main(){
+        FragColor = vec4(vertexColor, 1.0);
+    }
+#endif
+)";
+
+// Optional GL entry points
+// The context is only required to be 3.3 core, so newer functions are looked up at runtime and
+// every caller keeps a 3.3 fallback.
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+typedef void (APIENTRYP MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+typedef void (APIENTRYP BufferStorageProc)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+
+struct OptionalGL
+{
+    int major = 3, minor = 3;
+    int uniformBufferAlignment = 256;
+    MultiDrawElementsIndirectProc multiDrawElementsIndirect = nullptr;
+    BufferStorageProc bufferStorage = nullptr;
+    GetProgramBinaryProc getProgramBinary = nullptr;
+    ProgramBinaryProc programBinary = nullptr;
+    ProgramParameteriProc programParameteri = nullptr;
+    MaxShaderCompilerThreadsProc maxShaderCompilerThreads = nullptr;
+};
+
+OptionalGL optionalGL;
+
+bool hasGLExtension(const char* name)
+{
+    int count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (int i = 0; i < count; ++i)
+    {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (extension && strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool glVersionAtLeast(int major, int minor)
+{
+    return optionalGL.major > major || (optionalGL.major == major && optionalGL.minor >= minor);
+}
+
+// Call after gladLoadGLLoader with the same loader
+void loadOptionalGL(GLADloadproc load)
+{
+    optionalGL = OptionalGL();
+    glGetIntegerv(GL_MAJOR_VERSION, &optionalGL.major);
+    glGetIntegerv(GL_MINOR_VERSION, &optionalGL.minor);
+
+    // The per-command base instance needs 4.2 or ARB_base_instance
+    if (glVersionAtLeast(4, 3) || (hasGLExtension("GL_ARB_multi_draw_indirect") && hasGLExtension("GL_ARB_base_instance")))
+        optionalGL.multiDrawElementsIndirect = (MultiDrawElementsIndirectProc)load("glMultiDrawElementsIndirect");
+    // Persistent mapping for the frame ring
+    if (glVersionAtLeast(4, 4) || hasGLExtension("GL_ARB_buffer_storage"))
+        optionalGL.bufferStorage = (BufferStorageProc)load("glBufferStorage");
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &optionalGL.uniformBufferAlignment);
+
+    // Program binaries for the shader cache, only useful if the driver offers a format
+    int binaryFormats = 0;
+    if (glVersionAtLeast(4, 1) || hasGLExtension("GL_ARB_get_program_binary"))
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+    if (binaryFormats > 0)
+    {
+        optionalGL.getProgramBinary = (GetProgramBinaryProc)load("glGetProgramBinary");
+        optionalGL.programBinary = (ProgramBinaryProc)load("glProgramBinary");
+        optionalGL.programParameteri = (ProgramParameteriProc)load("glProgramParameteri");
+        if (!optionalGL.getProgramBinary || !optionalGL.programBinary || !optionalGL.programParameteri)
+        {
+            optionalGL.getProgramBinary = nullptr;
+            optionalGL.programBinary = nullptr;
+        }
+    }
+    if (hasGLExtension("GL_KHR_parallel_shader_compile"))
+        optionalGL.maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)load("glMaxShaderCompilerThreadsKHR");
+    else if (hasGLExtension("GL_ARB_parallel_shader_compile"))
+        optionalGL.maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)load("glMaxShaderCompilerThreadsARB");
+}
+
+// Shader programs
+// Every program is a named variant: a vertex and fragment source plus defines inserted after the
+// #version line. Linked programs are cached on disk with glGetProgramBinary, keyed by a hash of
+// the sources and the driver (vendor, renderer and version), so warm starts load binaries and
+// compile nothing. Cold starts issue every compile and link before checking any of them; with
+// KHR/ARB_parallel_shader_compile the driver runs them on its own threads meanwhile. Failures
+// print the variant name and the info log of the stage that failed.
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+struct ShaderVariant
+{
+    std::string name;
+    const char* vertexSource = nullptr;
+    const char* fragmentSource = nullptr;
+    std::string defines;        // e.g. "#define TRAILS 1\n"
+    uint64_t key = 0;           // sources and driver
+    unsigned int program = 0;
+    unsigned int vertexShader = 0, fragmentShader = 0; // only while a cold build is in flight
+    bool fromCache = false;
+};
+
+struct ShaderManager
+{
+    std::vector<ShaderVariant> variants;
+    std::string cacheDirectory = "shader_cache"; // empty disables the cache
+    int loaded = 0, compiled = 0;
+    double milliseconds = 0.0;
+};
+
+ShaderManager shaderManager;
+
+const char SHADER_CACHE_MAGIC[8] = { 'S', 'S', 'P', 'R', 'O', 'G', '1', '\0' };
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 1099511628211ull; // FNV-1a
+    return hash;
+}
+
+uint64_t hashString(const char* text, uint64_t hash)
+{
+    return hashBytes(text ? text : "", text ? std::strlen(text) + 1 : 1, hash);
+}
+
+int addShaderVariant(ShaderManager& manager, const std::string& name, const char* vertexSource,
+    const char* fragmentSource, const std::string& defines = "")
+{
+    ShaderVariant variant;
+    variant.name = name;
+    variant.vertexSource = vertexSource;
+    variant.fragmentSource = fragmentSource;
+    variant.defines = defines;
+    manager.variants.push_back(variant);
+    return (int)manager.variants.size() - 1;
+}
+
+unsigned int shaderProgramOf(const ShaderManager& manager, const std::string& name)
+{
+    for (const ShaderVariant& variant : manager.variants)
+        if (variant.name == name)
+            return variant.program;
+    return 0;
+}
+
+std::string shaderCachePath(const ShaderManager& manager, const ShaderVariant& variant)
+{
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", (unsigned long long)variant.key);
+    return manager.cacheDirectory + "/" + variant.name + "_" + key + ".bin";
+}
+
+void makeDirectory(const std::string& path)
+{
+#ifdef _WIN32
+    CreateDirectoryA(path.c_str(), NULL);
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+// The source with the defines spliced in after its #version line
+std::string withDefines(const char* source, const std::string& defines)
+{
+    std::string text = source;
+    size_t version = text.find("#version");
+    size_t lineEnd = version == std::string::npos ? std::string::npos : text.find('\n', version);
+    if (lineEnd == std::string::npos)
+        return defines + text;
+    return text.insert(lineEnd + 1, defines);
+}
+
+bool loadCachedProgram(const ShaderManager& manager, ShaderVariant& variant)
+{
+    if (manager.cacheDirectory.empty() || !optionalGL.programBinary)
+        return false;
+    std::ifstream file(shaderCachePath(manager, variant), std::ios::binary);
+    char magic[8];
+    uint32_t format = 0, length = 0;
+    if (!file.read(magic, 8) || std::memcmp(magic, SHADER_CACHE_MAGIC, 8) != 0 ||
+        !file.read((char*)&format, 4) || !file.read((char*)&length, 4))
+        return false;
+    // A truncated or corrupt entry must not size the buffer past what the file holds
+    std::streamoff start = file.tellg();
+    file.seekg(0, std::ios::end);
+    std::streamoff remaining = file.tellg() - start;
+    file.seekg(start);
+    if (length == 0 || (std::streamoff)length > remaining)
+        return false;
+    std::vector<char> binary(length);
+    if (!file.read(binary.data(), length))
+        return false;
+
+    variant.program = glCreateProgram();
+    optionalGL.programBinary(variant.program, format, binary.data(), (int)length);
+    int linked = 0;
+    glGetProgramiv(variant.program, GL_LINK_STATUS, &linked);
+    if (!linked) // a driver update or a corrupt file, rebuild from source
+    {
+        glDeleteProgram(variant.program);
+        variant.program = 0;
+    }
+    return linked != 0;
+}
+
+void saveCachedProgram(const ShaderManager& manager, const ShaderVariant& variant)
+{
+    if (manager.cacheDirectory.empty() || !optionalGL.getProgramBinary)
+        return;
+    int length = 0;
+    glGetProgramiv(variant.program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    optionalGL.getProgramBinary(variant.program, length, &length, &format, binary.data());
+    makeDirectory(manager.cacheDirectory);
+    std::ofstream file(shaderCachePath(manager, variant), std::ios::binary);
+    uint32_t header[2] = { (uint32_t)format, (uint32_t)length };
+    file.write(SHADER_CACHE_MAGIC, 8);
+    file.write((const char*)header, sizeof(header));
+    file.write(binary.data(), length);
+}
+
+unsigned int startShaderCompile(GLenum stage, const char* source, const std::string& defines)
+{
+    std::string text = withDefines(source, defines);
+    const char* pointer = text.c_str();
+    unsigned int shader = glCreateShader(stage);
+    glShaderSource(shader, 1, &pointer, NULL);
+    glCompileShader(shader);
+    return shader;
+}
+
+// Prints the compile log of a shader that failed, returns whether it compiled
+bool checkShaderStage(const ShaderVariant& variant, unsigned int shader, const char* stage)
+{
+    int compiled = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (compiled)
+        return true;
+    char log[4096] = "";
+    glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+    std::cout << "Shader " << variant.name << ": " << stage << " shader failed to compile\n" << log << std::endl;
+    return false;
+}
+
+// Builds every variant not built yet, returns false if any failed
+bool buildShaderPrograms(ShaderManager& manager)
+{
+    auto start = std::chrono::steady_clock::now();
+    uint64_t driver = hashString((const char*)glGetString(GL_VENDOR), 14695981039346656037ull);
+    driver = hashString((const char*)glGetString(GL_RENDERER), driver);
+    driver = hashString((const char*)glGetString(GL_VERSION), driver);
+    if (optionalGL.maxShaderCompilerThreads)
+        optionalGL.maxShaderCompilerThreads(0xFFFFFFFF); // as many as the driver likes
+
+    // Start everything first so parallel compilation has work to overlap
+    std::vector<ShaderVariant*> pending;
+    for (ShaderVariant& variant : manager.variants)
+    {
+        if (variant.program)
+            continue;
+        variant.key = hashString(variant.fragmentSource, hashString(variant.vertexSource,
+            hashString(variant.defines.c_str(), driver)));
+        variant.fromCache = loadCachedProgram(manager, variant);
+        if (variant.fromCache)
+        {
+            manager.loaded++;
+            continue;
+        }
+        variant.vertexShader = startShaderCompile(GL_VERTEX_SHADER, variant.vertexSource, variant.defines);
+        variant.fragmentShader = startShaderCompile(GL_FRAGMENT_SHADER, variant.fragmentSource, variant.defines);
+        variant.program = glCreateProgram();
+        glAttachShader(variant.program, variant.vertexShader);
+        glAttachShader(variant.program, variant.fragmentShader);
+        if (optionalGL.getProgramBinary)
+            optionalGL.programParameteri(variant.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(variant.program);
+        pending.push_back(&variant);
+    }
+
+    // Then wait on them in order
+    bool ok = true;
+    for (ShaderVariant* variant : pending)
+    {
+        int linked = 0;
+        glGetProgramiv(variant->program, GL_LINK_STATUS, &linked);
+        if (linked)
+        {
+            saveCachedProgram(manager, *variant);
+            manager.compiled++;
+        }
+        else
+        {
+            bool stagesOk = checkShaderStage(*variant, variant->vertexShader, "vertex");
+            stagesOk = checkShaderStage(*variant, variant->fragmentShader, "fragment") && stagesOk;
+            if (stagesOk)
+            {
+                char log[4096] = "";
+                glGetProgramInfoLog(variant->program, sizeof(log), NULL, log);
+                std::cout << "Shader " << variant->name << ": link failed\n" << log << std::endl;
+            }
+            glDeleteProgram(variant->program);
+            variant->program = 0;
+            ok = false;
+        }
+        glDeleteShader(variant->vertexShader);
+        glDeleteShader(variant->fragmentShader);
+        variant->vertexShader = variant->fragmentShader = 0;
+    }
+    manager.milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return ok;
+}
+
+void releaseShaderPrograms(ShaderManager& manager)
+{
+    for (ShaderVariant& variant : manager.variants)
+        if (variant.program)
+            glDeleteProgram(variant.program);
+    manager.variants.clear();
+    manager.loaded = manager.compiled = 0;
+    manager.milliseconds = 0.0;
+}
+
+// Frame ring
+// Everything written per frame (the camera block, instances, draw commands) is streamed through
+// one buffer split into a region per frame in flight. A fence per region marks when the GPU has
+// finished reading it, so by the time a region comes round again it is normally free and the CPU
+// writes without any implicit sync. With GL 4.4 or ARB_buffer_storage the buffer stays mapped
+// (persistent and coherent) for its whole life; on plain 3.3 the frame's region is mapped
+// unsynchronized instead, guarded by the same fences.
+const int FRAME_RING_REGIONS = 3;
+const size_t FRAME_RING_MIN_REGION = 1 << 20;
+const unsigned int CAMERA_BLOCK_BINDING = 0;
+
+struct FrameRing
+{
+    unsigned int buffer = 0;
+    size_t regionSize = 0;
+    bool persistent = false;
+    unsigned char* mapped = nullptr; // start of the current region while writable
+    int region = 0;
+    size_t used = 0;                 // bytes handed out in the current region
+    GLsync fences[FRAME_RING_REGIONS] = {};
+    long long fenceWaits = 0;        // frames whose region was still in use by the GPU
+};
+
+FrameRing frameRing;
+
+void waitRingFence(FrameRing& ring, int region)
+{
+    GLsync& fence = ring.fences[region];
+    if (!fence)
+        return;
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+    {
+        ring.fenceWaits++;
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+            ;
+    }
+    glDeleteSync(fence);
+    fence = 0;
+}
+
+void releaseFrameRing(FrameRing& ring)
+{
+    for (int region = 0; region < FRAME_RING_REGIONS; ++region)
+        waitRingFence(ring, region);
+    if (ring.buffer)
+    {
+        if (ring.persistent)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, ring.buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        }
+        glDeleteBuffers(1, &ring.buffer);
+    }
+    long long fenceWaits = ring.fenceWaits;
+    ring = FrameRing();
+    ring.fenceWaits = fenceWaits;
+}
+
+// (Re)creates the buffer with regions of at least the given size; only done between frames
+void allocateFrameRing(FrameRing& ring, size_t regionSize)
+{
+    releaseFrameRing(ring);
+    ring.regionSize = std::max(FRAME_RING_MIN_REGION, regionSize + (regionSize >> 1));
+    ring.regionSize = (ring.regionSize + 65535) & ~(size_t)65535;
+    size_t size = ring.regionSize * FRAME_RING_REGIONS;
+    glGenBuffers(1, &ring.buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ring.buffer);
+    ring.persistent = optionalGL.bufferStorage != nullptr;
+    if (ring.persistent)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        optionalGL.bufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags);
+        ring.mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+        ring.persistent = ring.mapped != nullptr;
+    }
+    if (!ring.persistent)
+        glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_DRAW);
+}
+
+// Makes the next region writable, growing the ring first if a frame needs more than a region
+void beginFrameRing(FrameRing& ring, size_t bytes)
+{
+    if (bytes > ring.regionSize)
+        allocateFrameRing(ring, bytes);
+    waitRingFence(ring, ring.region);
+    ring.used = 0;
+    size_t start = (size_t)ring.region * ring.regionSize;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ring.buffer);
+    if (!ring.persistent)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+        ring.mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, start, ring.regionSize, flags);
+    }
+}
+
+// Pointer to write bytes at, and their offset within the whole buffer for binding
+unsigned char* allocateFromRing(FrameRing& ring, size_t bytes, size_t alignment, size_t& offset)
+{
+    size_t local = (ring.used + alignment - 1) / alignment * alignment;
+    ring.used = local + bytes;
+    offset = (size_t)ring.region * ring.regionSize + local;
+    unsigned char* base = ring.persistent ? ring.mapped + (size_t)ring.region * ring.regionSize : ring.mapped;
+    return base + local;
+}
+
+// Writes must be finished before drawing: unmaps on 3.3, nothing to do when coherent
+void finishRingWrites(FrameRing& ring)
+{
+    if (ring.persistent || !ring.mapped)
+        return;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ring.buffer);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    ring.mapped = nullptr;
+}
+
+// Fences the region after the frame's last draw and moves on to the next one
+void endFrameRing(FrameRing& ring)
+{
+    finishRingWrites(ring);
+    ring.fences[ring.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ring.region = (ring.region + 1) % FRAME_RING_REGIONS;
+}
+
+// The view and projection matrices, std140 so two column-major mat4 back to back
+void writeCameraBlock(FrameRing& ring, const glm::mat4& view, const glm::mat4& projection)
+{
+    size_t offset;
+    unsigned char* block = allocateFromRing(ring, 2 * sizeof(glm::mat4), optionalGL.uniformBufferAlignment, offset);
+    std::memcpy(block, glm::value_ptr(view), sizeof(glm::mat4));
+    std::memcpy(block + sizeof(glm::mat4), glm::value_ptr(projection), sizeof(glm::mat4));
+    glBindBufferRange(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, ring.buffer, offset, 2 * sizeof(glm::mat4));
+}
+
+// Mesh pool
+// Every distinct shape is registered once, normalised to unit size (scale goes in the instance
+// transform) and packed into one shared VBO/EBO behind a single VAO. A mesh is a range of that
+// buffer drawn with a base vertex, so drawing never switches VAOs.
+// Vertices are stored compactly: snorm16 positions (the mesh spans [-1, 1] in storage and is
+// halved in the shader), an octahedral-encoded snorm8 normal for lighting, and an RGBA8 colour.
+// 12 bytes instead of six floats.
+struct PackedVertex
+{
+    int16_t position[3];
+    int8_t normal[2];
+    uint8_t color[4];
+};
+static_assert(sizeof(PackedVertex) == 12, "PackedVertex must stay 12 bytes");
+
+struct InstanceData
+{
+    glm::mat4 model;
+    uint32_t color; // RGBA8, red in the lowest byte
+};
+
+inline uint32_t packColor(const glm::vec4& color)
+{
+    uint32_t packed = 0;
+    for (int c = 0; c < 4; ++c)
+        packed |= (uint32_t)(glm::clamp(color[c], 0.0f, 1.0f) * 255.0f + 0.5f) << (8 * c);
+    return packed;
+}
+
+inline int16_t packSnorm16(float value)
+{
+    return (int16_t)lroundf(glm::clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+inline int8_t packSnorm8(float value)
+{
+    return (int8_t)lroundf(glm::clamp(value, -1.0f, 1.0f) * 127.0f);
+}
+
+// Octahedral normal encoding: project onto the octahedron |x| + |y| + |z| = 1 and fold the lower half
+glm::vec2 octEncode(glm::vec3 n)
+{
+    n /= fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    glm::vec2 encoded(n.x, n.y);
+    if (n.z < 0.0f)
+    {
+        encoded.x = (1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+        encoded.y = (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return encoded;
+}
+
+struct PooledMesh
+{
+    std::string name;
+    unsigned int firstIndex = 0, indexCount = 0, vertexCount = 0;
+    int baseVertex = 0;
+    std::vector<InstanceData> instances; // refilled every frame
+};
+
+struct DrawElementsIndirectCommand
+{
+    unsigned int count, instanceCount, firstIndex;
+    int baseVertex;
+    unsigned int baseInstance;
+};
+
+struct MeshPool
+{
+    unsigned int VAO = 0, VBO = 0, EBO = 0;
+    std::vector<PackedVertex> vertices;
+    std::vector<unsigned int> indices; // relative to each mesh's base vertex
+    unsigned int indexType = GL_UNSIGNED_INT;
+    size_t indexSize = sizeof(unsigned int);
+    std::vector<PooledMesh> meshes;
+    std::vector<DrawElementsIndirectCommand> commands;
+    size_t instanceOffset = 0, commandOffset = 0; // this frame's instances and commands in the frame ring
+    bool uploaded = false;
+};
+
+const int MESH_VERTEX_FLOATS = 6; // generators emit x, y, z, r, g, b
+
+int findMesh(const MeshPool& pool, const std::string& name)
+{
+    for (size_t i = 0; i < pool.meshes.size(); ++i)
+        if (pool.meshes[i].name == name)
+            return (int)i;
+    return -1;
+}
+
+// Adds a shape to the pool unless one with the same name is already there. Positions are
+// rescaled so the shape fits a unit diameter sphere, normals are the area weighted average of
+// the triangles sharing each vertex (so unshared vertices get flat face normals).
+int registerMesh(MeshPool& pool, const std::string& name,
+    const std::vector<float>& vertices, const std::vector<unsigned int>& indices)
+{
+    int existing = findMesh(pool, name);
+    if (existing >= 0)
+        return existing;
+
+    float radius2 = 0.0f;
+    for (size_t v = 0; v < vertices.size(); v += MESH_VERTEX_FLOATS)
+        radius2 = std::max(radius2, vertices[v] * vertices[v] + vertices[v + 1] * vertices[v + 1] + vertices[v + 2] * vertices[v + 2]);
+    float scale = radius2 > 0.0f ? 0.5f / sqrtf(radius2) : 1.0f;
+
+    size_t vertexCount = vertices.size() / MESH_VERTEX_FLOATS;
+    std::vector<glm::vec3> normals(vertexCount, glm::vec3(0.0f));
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        const float* a = &vertices[indices[i] * MESH_VERTEX_FLOATS];
+        const float* b = &vertices[indices[i + 1] * MESH_VERTEX_FLOATS];
+        const float* c = &vertices[indices[i + 2] * MESH_VERTEX_FLOATS];
+        glm::vec3 faceNormal = glm::cross(glm::vec3(b[0] - a[0], b[1] - a[1], b[2] - a[2]),
+            glm::vec3(c[0] - a[0], c[1] - a[1], c[2] - a[2]));
+        for (int k = 0; k < 3; ++k)
+            normals[indices[i + k]] += faceNormal;
+    }
+
+    PooledMesh mesh;
+    mesh.name = name;
+    mesh.firstIndex = (unsigned int)pool.indices.size();
+    mesh.indexCount = (unsigned int)indices.size();
+    mesh.baseVertex = (int)pool.vertices.size();
+    mesh.vertexCount = (unsigned int)vertexCount;
+
+    pool.vertices.reserve(pool.vertices.size() + vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        const float* source = &vertices[v * MESH_VERTEX_FLOATS];
+        PackedVertex packed;
+        for (int c = 0; c < 3; ++c)
+            packed.position[c] = packSnorm16(source[c] * scale * 2.0f);
+        glm::vec3 normal = normals[v];
+        glm::vec2 encoded = glm::dot(normal, normal) > 0.0f ? octEncode(normal) : glm::vec2(0.0f, 0.0f);
+        packed.normal[0] = packSnorm8(encoded.x);
+        packed.normal[1] = packSnorm8(encoded.y);
+        packed.color[0] = (uint8_t)lroundf(glm::clamp(source[3], 0.0f, 1.0f) * 255.0f);
+        packed.color[1] = (uint8_t)lroundf(glm::clamp(source[4], 0.0f, 1.0f) * 255.0f);
+        packed.color[2] = (uint8_t)lroundf(glm::clamp(source[5], 0.0f, 1.0f) * 255.0f);
+        packed.color[3] = 255;
+        pool.vertices.push_back(packed);
+    }
+    pool.indices.insert(pool.indices.end(), indices.begin(), indices.end());
+    pool.meshes.push_back(mesh);
+    pool.uploaded = false;
+    return (int)pool.meshes.size() - 1;
+}
+
+// Points the instance attributes at firstInstance of the instances starting at byte offset in
+// the buffer bound to GL_ARRAY_BUFFER
+void bindInstanceAttributes(size_t offset, size_t firstInstance)
+{
+    size_t base = offset + firstInstance * sizeof(InstanceData);
+    for (int column = 0; column < 4; ++column)
+        glVertexAttribPointer(2 + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(base + column * sizeof(glm::vec4)));
+    glVertexAttribPointer(6, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, color)));
+}
+
+// Creates the GL objects and uploads the packed geometry, call after the last registerMesh
+void uploadMeshPool(MeshPool& pool)
+{
+    if (pool.VAO == 0)
+    {
+        glGenVertexArrays(1, &pool.VAO);
+        glGenBuffers(1, &pool.VBO);
+        glGenBuffers(1, &pool.EBO);
+    }
+
+    // Indices are relative to the base vertex, so 16 bits suffice while every mesh stays under 64k vertices
+    bool shortIndices = true;
+    for (const PooledMesh& mesh : pool.meshes)
+        shortIndices = shortIndices && mesh.vertexCount <= 65536;
+    pool.indexType = shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    pool.indexSize = shortIndices ? sizeof(uint16_t) : sizeof(unsigned int);
+
+    glBindVertexArray(pool.VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, pool.VBO);
+    glBufferData(GL_ARRAY_BUFFER, pool.vertices.size() * sizeof(PackedVertex), pool.vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.EBO);
+    if (shortIndices)
+    {
+        std::vector<uint16_t> shortData(pool.indices.begin(), pool.indices.end());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortData.size() * sizeof(uint16_t), shortData.data(), GL_STATIC_DRAW);
+    }
+    else
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, pool.indices.size() * sizeof(unsigned int), pool.indices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, color));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(7, 2, GL_BYTE, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+    glEnableVertexAttribArray(7);
+
+    // Instance attributes are pointed into the frame ring every frame
+    for (int location = 2; location <= 6; ++location)
+    {
+        glEnableVertexAttribArray(location);
+        glVertexAttribDivisor(location, 1);
+    }
+    glBindVertexArray(0);
+    pool.uploaded = true;
+}
+
+void clearInstances(MeshPool& pool)
+{
+    for (PooledMesh& mesh : pool.meshes)
+        mesh.instances.clear();
+}
+
+// Frame ring space drawMeshPool needs this frame, alignment included
+size_t meshPoolStreamBytes(const MeshPool& pool)
+{
+    size_t total = 0;
+    for (const PooledMesh& mesh : pool.meshes)
+        total += mesh.instances.size();
+    return total * sizeof(InstanceData) + pool.meshes.size() * sizeof(DrawElementsIndirectCommand) + 64;
+}
+
+// Writes this frame's instances of every mesh into the frame ring back to back and builds one
+// draw command per mesh that has any
+void uploadPoolInstances(MeshPool& pool, FrameRing& ring, size_t total)
+{
+    ProfileScope uploadZone(ZONE_UPLOAD);
+    size_t instanceOffset;
+    unsigned char* out = allocateFromRing(ring, total * sizeof(InstanceData), 16, instanceOffset);
+
+    pool.commands.clear();
+    size_t firstInstance = 0;
+    for (const PooledMesh& mesh : pool.meshes)
+    {
+        if (mesh.instances.empty())
+            continue;
+        std::memcpy(out + firstInstance * sizeof(InstanceData), mesh.instances.data(), mesh.instances.size() * sizeof(InstanceData));
+        pool.commands.push_back({ mesh.indexCount, (unsigned int)mesh.instances.size(), mesh.firstIndex, mesh.baseVertex, (unsigned int)firstInstance });
+        firstInstance += mesh.instances.size();
+    }
+    if (optionalGL.multiDrawElementsIndirect)
+    {
+        size_t bytes = pool.commands.size() * sizeof(DrawElementsIndirectCommand);
+        std::memcpy(allocateFromRing(ring, bytes, 16, pool.commandOffset), pool.commands.data(), bytes);
+    }
+
+    glBindVertexArray(pool.VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, ring.buffer);
+    bindInstanceAttributes(instanceOffset, 0);
+    pool.instanceOffset = instanceOffset;
+}
+
+// Draws every instance, with one multi-draw-indirect call when available and one base-vertex
+// draw per mesh otherwise
+void drawMeshPool(MeshPool& pool, FrameRing& ring)
+{
+    size_t total = 0;
+    for (const PooledMesh& mesh : pool.meshes)
+        total += mesh.instances.size();
+    if (total == 0)
+        return;
+    uploadPoolInstances(pool, ring, total);
+    finishRingWrites(ring);
+
+    ProfileScope drawZone(ZONE_DRAW);
+    if (optionalGL.multiDrawElementsIndirect)
+    {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, ring.buffer);
+        optionalGL.multiDrawElementsIndirect(GL_TRIANGLES, pool.indexType, (void*)pool.commandOffset, (int)pool.commands.size(), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+    else
+    {
+        // No base instance in 3.3, so the instance attributes are re-pointed per mesh instead
+        for (const DrawElementsIndirectCommand& command : pool.commands)
+        {
+            bindInstanceAttributes(pool.instanceOffset, command.baseInstance);
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, pool.indexType,
+                (void*)(command.firstIndex * pool.indexSize), command.instanceCount, command.baseVertex);
+        }
+    }
+}
+
+void releaseMeshPool(MeshPool& pool)
+{
+    glDeleteVertexArrays(1, &pool.VAO);
+    glDeleteBuffers(1, &pool.VBO);
+    glDeleteBuffers(1, &pool.EBO);
+    pool = MeshPool();
+}
+
+// Memory and bandwidth of the pool against the previous layout of six floats per vertex, 32-bit
+// indices and float instance colours. Vertex fetch assumes no post-transform cache reuse, so it
+// is an upper bound.
+void printMeshPoolReport(const MeshPool& pool, const std::vector<size_t>& instanceCounts)
+{
+    const size_t legacyVertexSize = MESH_VERTEX_FLOATS * sizeof(float), legacyIndexSize = sizeof(unsigned int);
+    const size_t legacyInstanceSize = sizeof(glm::mat4) + sizeof(glm::vec4);
+    size_t indexSize = pool.indexSize;
+    for (const PooledMesh& mesh : pool.meshes)
+        if (mesh.vertexCount > 65536)
+            indexSize = sizeof(unsigned int);
+
+    std::cout << "mesh,vertices,indices,instances,legacy_bytes,compact_bytes,legacy_frame_bytes,compact_frame_bytes" << std::endl;
+    size_t totals[4] = { 0, 0, 0, 0 };
+    for (size_t i = 0; i < pool.meshes.size(); ++i)
+    {
+        const PooledMesh& mesh = pool.meshes[i];
+        size_t instances = i < instanceCounts.size() ? instanceCounts[i] : 0;
+        size_t legacy = mesh.vertexCount * legacyVertexSize + mesh.indexCount * legacyIndexSize;
+        size_t compact = mesh.vertexCount * sizeof(PackedVertex) + mesh.indexCount * indexSize;
+        size_t legacyFrame = instances * (mesh.indexCount * (legacyVertexSize + legacyIndexSize) + legacyInstanceSize);
+        size_t compactFrame = instances * (mesh.indexCount * (sizeof(PackedVertex) + indexSize) + sizeof(InstanceData));
+        std::cout << mesh.name << "," << mesh.vertexCount << "," << mesh.indexCount << "," << instances << ","
+            << legacy << "," << compact << "," << legacyFrame << "," << compactFrame << std::endl;
+        totals[0] += legacy; totals[1] += compact; totals[2] += legacyFrame; totals[3] += compactFrame;
+    }
+    std::cout << "total,,,," << totals[0] << "," << totals[1] << "," << totals[2] << "," << totals[3] << std::endl;
+}
+
+// Frustum culling
+// Bounding spheres are kept as a structure of arrays so the plane tests run 8 (AVX2) or 4 (SSE2)
+// spheres at a time. Only the indices of the spheres that survive are written out.
+struct Frustum
+{
+    float a[6], b[6], c[6], d[6]; // inside when a*x + b*y + c*z + d >= -radius
+};
+
+// Gribb-Hartmann plane extraction from a view-projection matrix, planes normalised so the
+// distance compares directly against a radius
+Frustum extractFrustum(const glm::mat4& viewProjection)
+{
+    Frustum frustum;
+    for (int p = 0; p < 6; ++p)
+    {
+        int row = p / 2;
+        float sign = (p % 2 == 0) ? 1.0f : -1.0f;
+        glm::vec4 plane;
+        for (int column = 0; column < 4; ++column)
+            plane[column] = viewProjection[column][3] + sign * viewProjection[column][row];
+        float length = sqrtf(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+        frustum.a[p] = plane.x / length;
+        frustum.b[p] = plane.y / length;
+        frustum.c[p] = plane.z / length;
+        frustum.d[p] = plane.w / length;
+    }
+    return frustum;
+}
+
+struct SphereBounds
+{
+    std::vector<float> x, y, z, radius;
+
+    size_t size() const { return x.size(); }
+    void clear() { x.clear(); y.clear(); z.clear(); radius.clear(); }
+    void reserve(size_t count) { x.reserve(count); y.reserve(count); z.reserve(count); radius.reserve(count); }
+    void resize(size_t count) { x.resize(count); y.resize(count); z.resize(count); radius.resize(count); }
+    void push(const glm::vec3& center, float r)
+    {
+        x.push_back(center.x); y.push_back(center.y); z.push_back(center.z); radius.push_back(r);
+    }
+};
+
+struct CullStats
+{
+    long long tested = 0, culled = 0, drawn = 0; // this frame
+    long long frames = 0, totalTested = 0, totalCulled = 0, totalDrawn = 0;
+};
+
+CullStats cullStats;
+
+void beginCullFrame()
+{
+    cullStats.tested = cullStats.culled = cullStats.drawn = 0;
+    cullStats.frames++;
+}
+
+// Average per frame since startup
+void printCullStats()
+{
+    if (cullStats.frames == 0)
+        return;
+    double frames = (double)cullStats.frames;
+    std::cout << "Culling: " << cullStats.totalTested / frames << " tested, " << cullStats.totalCulled / frames
+        << " culled, " << cullStats.totalDrawn / frames << " drawn per frame" << std::endl;
+}
+
+inline bool sphereInFrustum(const Frustum& frustum, float x, float y, float z, float radius)
+{
+    for (int p = 0; p < 6; ++p)
+        if (frustum.a[p] * x + frustum.b[p] * y + frustum.c[p] * z + frustum.d[p] < -radius)
+            return false;
+    return true;
+}
+
+// Appends the index of every sphere in [begin, end) touching the frustum to visible
+void cullSphereRange(const SphereBounds& bounds, const Frustum& frustum, size_t begin, size_t end,
+    std::vector<uint32_t>& visible)
+{
+    const float* xs = bounds.x.data(), * ys = bounds.y.data(), * zs = bounds.z.data(), * rs = bounds.radius.data();
+    size_t i = begin;
+#if defined(__AVX2__)
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(xs + i), y = _mm256_loadu_ps(ys + i), z = _mm256_loadu_ps(zs + i);
+        __m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(rs + i));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; ++p)
+        {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(frustum.a[p]), x), _mm256_mul_ps(_mm256_set1_ps(frustum.b[p]), y)),
+                _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(frustum.c[p]), z), _mm256_set1_ps(frustum.d[p])));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negRadius, _CMP_GE_OQ));
+        }
+        int mask = _mm256_movemask_ps(inside);
+        for (int k = 0; k < 8; ++k)
+            if (mask & (1 << k))
+                visible.push_back((uint32_t)(i + k));
+    }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(xs + i), y = _mm_loadu_ps(ys + i), z = _mm_loadu_ps(zs + i);
+        __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(rs + i));
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; ++p)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(frustum.a[p]), x), _mm_mul_ps(_mm_set1_ps(frustum.b[p]), y)),
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(frustum.c[p]), z), _mm_set1_ps(frustum.d[p])));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (int k = 0; k < 4; ++k)
+            if (mask & (1 << k))
+                visible.push_back((uint32_t)(i + k));
+    }
+#endif
+    for (; i < end; ++i)
+        if (sphereInFrustum(frustum, xs[i], ys[i], zs[i], rs[i]))
+            visible.push_back((uint32_t)i);
+}
+
+void recordCull(size_t count, size_t survivors)
+{
+    cullStats.tested += count;
+    cullStats.culled += count - survivors;
+    cullStats.drawn += survivors;
+    cullStats.totalTested += count;
+    cullStats.totalCulled += count - survivors;
+    cullStats.totalDrawn += survivors;
+}
+
+// Culls every sphere, appending the survivors to visible and returning how many there were
+size_t cullSpheres(const SphereBounds& bounds, const Frustum& frustum, std::vector<uint32_t>& visible)
+{
+    size_t before = visible.size();
+    cullSphereRange(bounds, frustum, 0, bounds.size(), visible);
+    recordCull(bounds.size(), visible.size() - before);
+    return visible.size() - before;
+}
+
+// Uniform scale and translation written straight into the matrix
+inline glm::mat4 scaleTranslate(const glm::vec3& position, float scale)
+{
+    glm::mat4 model(scale);
+    model[3] = glm::vec4(position, 1.0f);
+    return model;
+}
+
+// Scene resources
+unsigned int shaderProgram;
+MeshPool meshPool;
+int octahedronMesh = -1;
+
+// Sphere LOD chain, one icosphere per subdivision level. A body switches level when its projected
+// radius crosses LOD_PIXEL_LIMITS by more than the hysteresis margin, so it does not flicker
+// between two levels at the boundary.
+const int SPHERE_LOD_LEVELS = 6;
+const float LOD_PIXEL_LIMITS[SPHERE_LOD_LEVELS - 1] = { 3.0f, 8.0f, 24.0f, 64.0f, 160.0f };
+const float LOD_HYSTERESIS = 0.15f;
+int sphereLodMesh[SPHERE_LOD_LEVELS];
+std::vector<uint8_t> bodyLod; // current level per N-body body
+
+int selectLod(float radiusPixels, int current)
+{
+    int level = current;
+    while (level < SPHERE_LOD_LEVELS - 1 && radiusPixels > LOD_PIXEL_LIMITS[level] * (1.0f + LOD_HYSTERESIS))
+        ++level;
+    while (level > 0 && radiusPixels < LOD_PIXEL_LIMITS[level - 1] * (1.0f - LOD_HYSTERESIS))
+        --level;
+    return level;
+}
+
+SphereBounds asteroidBounds;
+std::vector<uint32_t> visibleBodies;
+
+// Culling, LOD selection and instance packing run as one job per fixed size batch of asteroids.
+// Batches keep their own survivors and instances, appended in batch order afterwards so the
+// result does not depend on the thread count.
+const size_t ASTEROID_BATCH = 8192;
+
+struct AsteroidBatch
+{
+    std::vector<uint32_t> visible;
+    std::vector<InstanceData> instances[SPHERE_LOD_LEVELS];
+};
+
+std::vector<AsteroidBatch> asteroidBatches;
+
+// Adds an instance per asteroid inside the frustum, each at the sphere level that suits its
+// projected radius in pixels
+void addAsteroidInstances(const glm::vec3& cameraWorldPos, const Frustum& frustum, float fovY, int height)
+{
+    const uint32_t white = packColor(glm::vec4(1.0f));
+    const float size = (float)scene.asteroidSize, auToScene = (float)scene.earthOrbitRadius;
+    size_t first = nbodyFirstAsteroid, count = nbodyCount() - first;
+    asteroidBounds.resize(count);
+    parallelFor(count, 4096, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            glm::vec3 position = nbodyPosition((int)(first + i)) * auToScene;
+            asteroidBounds.x[i] = position.x;
+            asteroidBounds.y[i] = position.y;
+            asteroidBounds.z[i] = position.z;
+            asteroidBounds.radius[i] = size * 0.5f;
+        }
+    });
+
+    bodyLod.resize(first + count, 0);
+    float radiusPixelsAtUnit = size * 0.5f * height * 0.5f / tanf(fovY * 0.5f);
+    size_t batches = (count + ASTEROID_BATCH - 1) / ASTEROID_BATCH;
+    if (asteroidBatches.size() < batches)
+        asteroidBatches.resize(batches);
+    parallelFor(batches, 1, [&](size_t begin, size_t end) {
+        for (size_t b = begin; b < end; ++b)
+        {
+            AsteroidBatch& batch = asteroidBatches[b];
+            batch.visible.clear();
+            for (std::vector<InstanceData>& instances : batch.instances)
+                instances.clear();
+            cullSphereRange(asteroidBounds, frustum, b * ASTEROID_BATCH, std::min(count, (b + 1) * ASTEROID_BATCH), batch.visible);
+            for (uint32_t v : batch.visible)
+            {
+                glm::vec3 position(asteroidBounds.x[v], asteroidBounds.y[v], asteroidBounds.z[v]);
+                float distance = std::max(glm::length(position - cameraWorldPos), 0.1f);
+                int level = selectLod(radiusPixelsAtUnit / distance, bodyLod[first + v]);
+                bodyLod[first + v] = (uint8_t)level;
+                batch.instances[level].push_back({ scaleTranslate(position, size), white });
+            }
+        }
+    });
+
+    visibleBodies.clear();
+    for (size_t b = 0; b < batches; ++b)
+    {
+        const AsteroidBatch& batch = asteroidBatches[b];
+        visibleBodies.insert(visibleBodies.end(), batch.visible.begin(), batch.visible.end());
+        for (int level = 0; level < SPHERE_LOD_LEVELS; ++level)
+        {
+            std::vector<InstanceData>& instances = meshPool.meshes[sphereLodMesh[level]].instances;
+            instances.insert(instances.end(), batch.instances[level].begin(), batch.instances[level].end());
+        }
+    }
+    recordCull(count, visibleBodies.size());
+}
+
+// Picking
+// A click casts a ray through the cursor against the bodies' bounding spheres as they were in the
+// last frame drawn. The Sun, Earth and Moon are tested directly; the asteroids sit in a bounding
+// volume hierarchy over their Morton-sorted centres, split where the codes first differ. In the
+// window it is refitted every frame (the same tree with its boxes recomputed around the moved
+// spheres) and only rebuilt when the count changes or refitting has let the boxes' total surface
+// area grow past BVH_REBUILD_GROWTH times what the build produced. Like the Barnes-Hut octree,
+// nodes are stored depth first with the index just past their subtree, so the ray walks it
+// without a stack.
+const unsigned int BVH_LEAF_SIZE = 8;
+const double BVH_REBUILD_GROWTH = 2.0;
+
+struct BvhNode
+{
+    float minX, minY, minZ, maxX, maxY, maxZ;
+    unsigned int begin, end;  // range in order
+    unsigned int next;        // first node after this subtree
+    unsigned int leaf;
+};
+
+struct SphereBvh
+{
+    std::vector<std::pair<unsigned long long, unsigned int>> keys; // Morton code, sphere index
+    std::vector<unsigned int> order;                              // sphere indices in Morton order
+    std::vector<unsigned int> rank;                               // position of every sphere in order
+    std::vector<glm::vec4> spheres;                               // centre and radius in Morton order
+    std::vector<BvhNode> nodes;
+    std::vector<unsigned int> leaves;                             // node index of every leaf
+    double builtArea = 0.0, area = 0.0;                           // summed box surface areas
+    long long builds = 0, refits = 0;
+};
+
+SphereBounds bodyBounds; // Sun, Earth and Moon in the last frame
+SphereBvh asteroidBvh;
+bool pickingEnabled = false; // only the window refits the BVH
+glm::mat4 pickViewProjection(1.0f);
+
+// Appends the subtree over sorted spheres [begin, end), returns its root index
+unsigned int buildBvhNode(SphereBvh& bvh, unsigned int begin, unsigned int end)
+{
+    unsigned int index = (unsigned int)bvh.nodes.size();
+    bvh.nodes.push_back(BvhNode());
+    bool leaf = end - begin <= BVH_LEAF_SIZE;
+    if (leaf)
+        bvh.leaves.push_back(index);
+    else
+    {
+        // Split at the highest bit where the first and last codes differ, or halve the range
+        // when every code is the same
+        unsigned long long different = bvh.keys[begin].first ^ bvh.keys[end - 1].first;
+        unsigned int split = begin + (end - begin) / 2;
+        if (different != 0)
+        {
+            int bit = 63;
+            while (!(different >> bit & 1))
+                --bit;
+            unsigned long long mask = 1ULL << bit;
+            split = (unsigned int)(std::partition_point(bvh.keys.begin() + begin, bvh.keys.begin() + end,
+                [mask](const std::pair<unsigned long long, unsigned int>& key) { return !(key.first & mask); })
+                - bvh.keys.begin());
+        }
+        buildBvhNode(bvh, begin, split);
+        buildBvhNode(bvh, split, end);
+    }
+    BvhNode& node = bvh.nodes[index];
+    node.begin = begin;
+    node.end = end;
+    node.leaf = leaf;
+    node.next = (unsigned int)bvh.nodes.size();
+    return index;
+}
+
+// Recomputes every box around the spheres' current positions, keeping the tree. The spheres are
+// first scattered into Morton order, which streams through the inputs where gathering them leaf
+// by leaf would miss the cache on nearly every sphere.
+void refitBvh(SphereBvh& bvh, const SphereBounds& bounds)
+{
+    bvh.spheres.resize(bounds.size());
+    parallelFor(bounds.size(), 4096, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            bvh.spheres[bvh.rank[i]] = glm::vec4(bounds.x[i], bounds.y[i], bounds.z[i], bounds.radius[i]);
+    });
+    parallelFor(bvh.leaves.size(), 1024, [&](size_t begin, size_t end) {
+        for (size_t l = begin; l < end; ++l)
+        {
+            BvhNode& node = bvh.nodes[bvh.leaves[l]];
+            float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, maxZ = -FLT_MAX;
+            for (unsigned int k = node.begin; k < node.end; ++k)
+            {
+                const glm::vec4& sphere = bvh.spheres[k];
+                minX = std::min(minX, sphere.x - sphere.w); maxX = std::max(maxX, sphere.x + sphere.w);
+                minY = std::min(minY, sphere.y - sphere.w); maxY = std::max(maxY, sphere.y + sphere.w);
+                minZ = std::min(minZ, sphere.z - sphere.w); maxZ = std::max(maxZ, sphere.z + sphere.w);
+            }
+            node.minX = minX; node.minY = minY; node.minZ = minZ;
+            node.maxX = maxX; node.maxY = maxY; node.maxZ = maxZ;
+        }
+    });
+
+    // Children are stored after their parent, so walking backwards reaches both of them first
+    double area = 0.0;
+    for (size_t n = bvh.nodes.size(); n-- > 0;)
+    {
+        BvhNode& node = bvh.nodes[n];
+        if (!node.leaf)
+        {
+            const BvhNode& left = bvh.nodes[n + 1], & right = bvh.nodes[left.next];
+            node.minX = std::min(left.minX, right.minX); node.maxX = std::max(left.maxX, right.maxX);
+            node.minY = std::min(left.minY, right.minY); node.maxY = std::max(left.maxY, right.maxY);
+            node.minZ = std::min(left.minZ, right.minZ); node.maxZ = std::max(left.maxZ, right.maxZ);
+        }
+        double dx = node.maxX - node.minX, dy = node.maxY - node.minY, dz = node.maxZ - node.minZ;
+        area += 2.0 * (dx * dy + dy * dz + dz * dx);
+    }
+    bvh.area = area;
+    bvh.refits++;
+}
+
+void buildBvh(SphereBvh& bvh, const SphereBounds& bounds)
+{
+    const size_t n = bounds.size();
+    bvh.nodes.clear();
+    bvh.leaves.clear();
+    bvh.order.resize(n);
+    bvh.rank.resize(n);
+    bvh.builds++;
+    if (n == 0)
+        return;
+
+    float minX = *std::min_element(bounds.x.begin(), bounds.x.end()), maxX = *std::max_element(bounds.x.begin(), bounds.x.end());
+    float minY = *std::min_element(bounds.y.begin(), bounds.y.end()), maxY = *std::max_element(bounds.y.begin(), bounds.y.end());
+    float minZ = *std::min_element(bounds.z.begin(), bounds.z.end()), maxZ = *std::max_element(bounds.z.begin(), bounds.z.end());
+    double size = std::max(std::max(maxX - minX, maxY - minY), std::max(maxZ - minZ, 1e-6f)) * (1.0 + 1e-6);
+    double scale = (double)(1 << MORTON_BITS) / size;
+
+    bvh.keys.resize(n);
+    parallelFor(n, 4096, [&](size_t begin, size_t end) {
+        const unsigned long long maxCell = (1 << MORTON_BITS) - 1;
+        for (size_t i = begin; i < end; ++i)
+        {
+            unsigned long long cx = std::min(maxCell, (unsigned long long)((bounds.x[i] - minX) * scale));
+            unsigned long long cy = std::min(maxCell, (unsigned long long)((bounds.y[i] - minY) * scale));
+            unsigned long long cz = std::min(maxCell, (unsigned long long)((bounds.z[i] - minZ) * scale));
+            bvh.keys[i] = { expandMortonBits(cx) << 2 | expandMortonBits(cy) << 1 | expandMortonBits(cz), (unsigned int)i };
+        }
+    });
+    parallelSort(bvh.keys);
+    for (size_t k = 0; k < n; ++k)
+    {
+        bvh.order[k] = bvh.keys[k].second;
+        bvh.rank[bvh.keys[k].second] = (unsigned int)k;
+    }
+
+    buildBvhNode(bvh, 0, (unsigned int)n);
+    refitBvh(bvh, bounds);
+    bvh.builtArea = bvh.area;
+}
+
+// Refits to this frame's spheres, rebuilding when that would leave the tree too loose
+void updateBvh(SphereBvh& bvh, const SphereBounds& bounds)
+{
+    if (bvh.order.size() != bounds.size() || bvh.nodes.empty())
+    {
+        buildBvh(bvh, bounds);
+        return;
+    }
+    refitBvh(bvh, bounds);
+    if (bvh.area > bvh.builtArea * BVH_REBUILD_GROWTH)
+        buildBvh(bvh, bounds);
+}
+
+// Distance along the ray (unit direction) to where it enters the sphere, 0 from inside, -1 for a miss
+inline float raySphere(const glm::vec3& origin, const glm::vec3& direction, float x, float y, float z, float radius)
+{
+    glm::vec3 toCenter(x - origin.x, y - origin.y, z - origin.z);
+    float along = glm::dot(toCenter, direction);
+    float discriminant = along * along - (glm::dot(toCenter, toCenter) - radius * radius);
+    if (discriminant < 0.0f)
+        return -1.0f;
+    float halfChord = sqrtf(discriminant);
+    if (along + halfChord < 0.0f)
+        return -1.0f;
+    return std::max(along - halfChord, 0.0f);
+}
+
+// Index of the nearest sphere the ray hits before nearest, which is shortened to it, or -1
+int raycastBvh(const SphereBvh& bvh, const glm::vec3& origin, const glm::vec3& direction, float& nearest)
+{
+    glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    int hit = -1;
+    unsigned int n = 0;
+    while (n < bvh.nodes.size())
+    {
+        const BvhNode& node = bvh.nodes[n];
+        float x0 = (node.minX - origin.x) * inverse.x, x1 = (node.maxX - origin.x) * inverse.x;
+        float y0 = (node.minY - origin.y) * inverse.y, y1 = (node.maxY - origin.y) * inverse.y;
+        float z0 = (node.minZ - origin.z) * inverse.z, z1 = (node.maxZ - origin.z) * inverse.z;
+        float enter = std::max(std::max(std::min(x0, x1), std::min(y0, y1)), std::max(std::min(z0, z1), 0.0f));
+        float exit = std::min(std::min(std::max(x0, x1), std::max(y0, y1)), std::min(std::max(z0, z1), nearest));
+        if (enter > exit)
+        {
+            n = node.next;
+            continue;
+        }
+        if (!node.leaf)
+        {
+            ++n;
+            continue;
+        }
+        for (unsigned int k = node.begin; k < node.end; ++k)
+        {
+            const glm::vec4& sphere = bvh.spheres[k];
+            float t = raySphere(origin, direction, sphere.x, sphere.y, sphere.z, sphere.w);
+            if (t >= 0.0f && t < nearest)
+            {
+                nearest = t;
+                hit = (int)bvh.order[k];
+            }
+        }
+        n = node.next;
+    }
+    return hit;
+}
+
+// Body under the cursor in the last frame drawn: 0-2 for the Sun, Earth and Moon, 3 + i for
+// asteroid i, -1 for none. The cursor is in window coordinates.
+int pickBody(double cursorX, double cursorY, int windowWidth, int windowHeight)
+{
+    glm::mat4 inverse = glm::inverse(pickViewProjection);
+    float ndcX = (float)(2.0 * cursorX / std::max(windowWidth, 1) - 1.0);
+    float ndcY = (float)(1.0 - 2.0 * cursorY / std::max(windowHeight, 1));
+    glm::vec4 nearPoint = inverse * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+    glm::vec4 farPoint = inverse * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+    glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w, end = glm::vec3(farPoint) / farPoint.w;
+    float nearest = glm::length(end - origin); // nothing past the far plane
+    glm::vec3 direction = (end - origin) / nearest;
+
+    int hit = -1;
+    for (size_t b = 0; b < bodyBounds.size(); ++b)
+    {
+        float t = raySphere(origin, direction, bodyBounds.x[b], bodyBounds.y[b], bodyBounds.z[b], bodyBounds.radius[b]);
+        if (t >= 0.0f && t < nearest)
+        {
+            nearest = t;
+            hit = (int)b;
+        }
+    }
+    if (asteroidBvh.order.size() == asteroidBounds.size())
+    {
+        int asteroid = raycastBvh(asteroidBvh, origin, direction, nearest);
+        if (asteroid >= 0)
+            hit = 3 + asteroid;
+    }
+    return hit;
+}
+
+// Left click points the camera at the body under the cursor
+void mouse_button_callback(GLFWwindow* window, int button, int action, int /*mods*/)
+{
+    if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS)
+        return;
+    double cursorX, cursorY;
+    int width, height;
+    glfwGetCursorPos(window, &cursorX, &cursorY);
+    glfwGetWindowSize(window, &width, &height);
+    auto start = std::chrono::steady_clock::now();
+    int body = pickBody(cursorX, cursorY, width, height);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (body < 0)
+        return;
+    followBody(body);
+    std::cout << "Picked in " << ms << " ms" << std::endl;
+}
+
+// Orbit trails
+// The last capacity positions of every body live in one GPU buffer allocated once, slot after
+// slot, so one moment of every body is a contiguous range. Only the newest slot is written each
+// frame: the bodies' current positions go through the frame ring and are copied into the slot on
+// the GPU. Once stepDays have passed the next slot becomes the newest, overwriting the oldest, so
+// memory stays at bodies x capacity however long the run. All trails are one instanced line strip
+// draw, an instance per body; the vertex shader reads its sample from the buffer as a texture
+// buffer, walking back from the newest slot around the ring, and fades the tail out.
+struct TrailCopy
+{
+    size_t offset; // in the frame ring
+    int slot;
+};
+
+// GL guarantees texture buffers of 65536 texels, enough for the Sun, Earth and Moon at this length
+const int MAX_TRAIL_SAMPLES = 65536 / 9;
+
+struct OrbitTrails
+{
+    int capacity = 0;             // samples per body, 0 disables trails
+    double stepDays = 1.0;        // simulated time between samples
+    size_t bodies = 0, allocatedBodies = 0;
+    unsigned int buffer = 0, texture = 0, VAO = 0, program = 0;
+    int headLoc = -1, capacityLoc = -1, bodiesLoc = -1, filledLoc = -1;
+    int head = 0, filled = 0;     // newest slot, and how many slots hold samples
+    long long interval = 0;       // stepDays interval the newest slot belongs to
+    std::vector<float> latest;    // current positions for the newest slot, xyz per body
+    bool latestUploaded = false;
+    // Slots finished in frames that were not drawn, waiting for the next drawn frame
+    std::vector<float> pending;
+    std::vector<int> pendingSlots;
+    std::vector<TrailCopy> copies; // this frame's writes into the trail buffer
+};
+
+OrbitTrails trails;
+
+size_t trailSlotBytes(const OrbitTrails& trails)
+{
+    return trails.bodies * 3 * sizeof(float);
+}
+
+// Creates the buffer for the current body count, trimmed to what a texture buffer can address
+void allocateTrails(OrbitTrails& trails)
+{
+    if (trails.VAO == 0)
+    {
+        glGenVertexArrays(1, &trails.VAO); // no attributes, but core profile draws need one
+        glGenBuffers(1, &trails.buffer);
+        glGenTextures(1, &trails.texture);
+    }
+    int maxTexels = 65536;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    size_t maxBodies = (size_t)maxTexels / (3 * (size_t)trails.capacity);
+    if (maxBodies < 3) // the Sun, Earth and Moon always keep their trails, shorter if need be
+    {
+        trails.capacity = maxTexels / 9;
+        maxBodies = (size_t)maxTexels / (3 * (size_t)trails.capacity);
+        std::cout << "Trails: shortened to " << trails.capacity << " samples to fit a texture buffer" << std::endl;
+    }
+    if (trails.bodies > maxBodies)
+    {
+        std::cout << "Trails: only the first " << maxBodies << " of " << trails.bodies
+            << " bodies fit in a texture buffer at " << trails.capacity << " samples" << std::endl;
+        trails.bodies = maxBodies;
+    }
+    trails.allocatedBodies = trails.bodies;
+
+    glBindBuffer(GL_TEXTURE_BUFFER, trails.buffer);
+    glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(trailSlotBytes(trails) * trails.capacity, 4), NULL, GL_DYNAMIC_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, trails.texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, trails.buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    std::cout << "Trails: " << trails.bodies << " bodies x " << trails.capacity << " samples, "
+        << trailSlotBytes(trails) * trails.capacity / 1024 << " KB" << std::endl;
+}
+
+// Takes this frame's positions, after gatherInstances has placed the asteroids. Runs for frames
+// that are not drawn as well, so a trail does not depend on which frames were.
+void recordTrails(OrbitTrails& trails, double day)
+{
+    if (trails.capacity == 0)
+        return;
+    size_t asteroids = physicsMode != PhysicsMode::Analytic ? nbodyCount() - nbodyFirstAsteroid : 0;
+    size_t bodies = 3 + asteroids;
+    if (trails.allocatedBodies != 0)
+        bodies = std::min(bodies, trails.allocatedBodies);
+    long long interval = (long long)std::floor(day / trails.stepDays);
+    if (bodies != trails.bodies)
+    {
+        trails.bodies = bodies;
+        trails.filled = 0;
+        trails.pending.clear();
+        trails.pendingSlots.clear();
+    }
+
+    if (trails.filled == 0)
+    {
+        trails.head = 0;
+        trails.filled = 1;
+    }
+    else if (interval != trails.interval)
+    {
+        // The newest slot is done; keep its last positions if no drawn frame sent them
+        if (!trails.latestUploaded)
+        {
+            if ((int)trails.pendingSlots.size() == trails.capacity)
+            {
+                trails.pendingSlots.erase(trails.pendingSlots.begin());
+                trails.pending.erase(trails.pending.begin(), trails.pending.begin() + bodies * 3);
+            }
+            trails.pending.insert(trails.pending.end(), trails.latest.begin(), trails.latest.end());
+            trails.pendingSlots.push_back(trails.head);
+        }
+        trails.head = (trails.head + 1) % trails.capacity;
+        trails.filled = std::min(trails.filled + 1, trails.capacity);
+    }
+    trails.interval = interval;
+
+    trails.latest.resize(bodies * 3);
+    float* out = trails.latest.data();
+    const int bodyNodes[3] = { sunBodyNode, earthBodyNode, moonBodyNode };
+    for (int b = 0; b < 3; ++b)
+    {
+        glm::vec3 position = worldPosition(sceneGraph, bodyNodes[b]);
+        out[b * 3] = position.x;
+        out[b * 3 + 1] = position.y;
+        out[b * 3 + 2] = position.z;
+    }
+    parallelFor(bodies - 3, 16384, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            out[(3 + i) * 3] = asteroidBounds.x[i];
+            out[(3 + i) * 3 + 1] = asteroidBounds.y[i];
+            out[(3 + i) * 3 + 2] = asteroidBounds.z[i];
+        }
+    });
+    trails.latestUploaded = false;
+}
+
+// Frame ring space writeTrails needs this frame
+size_t trailStreamBytes(const OrbitTrails& trails)
+{
+    if (trails.capacity == 0)
+        return 0;
+    return (trails.pendingSlots.size() + 1) * (trailSlotBytes(trails) + 16);
+}
+
+// Puts the finished slots and the newest one in the frame ring, call before the ring's writes finish
+void writeTrails(OrbitTrails& trails, FrameRing& ring)
+{
+    trails.copies.clear();
+    if (trails.capacity == 0 || trails.filled == 0)
+        return;
+    ProfileScope uploadZone(ZONE_UPLOAD);
+    if (trails.allocatedBodies == 0)
+        allocateTrails(trails);
+    size_t slotBytes = trailSlotBytes(trails);
+    for (size_t p = 0; p < trails.pendingSlots.size(); ++p)
+    {
+        TrailCopy copy = { 0, trails.pendingSlots[p] };
+        std::memcpy(allocateFromRing(ring, slotBytes, 16, copy.offset), trails.pending.data() + p * trails.bodies * 3, slotBytes);
+        trails.copies.push_back(copy);
+    }
+    TrailCopy newest = { 0, trails.head };
+    std::memcpy(allocateFromRing(ring, slotBytes, 16, newest.offset), trails.latest.data(), slotBytes);
+    trails.copies.push_back(newest);
+    trails.pending.clear();
+    trails.pendingSlots.clear();
+    trails.latestUploaded = true;
+}
+
+// Copies this frame's slots into the trail buffer and draws every trail, after the opaque bodies
+void drawTrails(OrbitTrails& trails, FrameRing& ring)
+{
+    if (trails.copies.empty())
+        return;
+    finishRingWrites(ring);
+    size_t slotBytes = trailSlotBytes(trails);
+    glBindBuffer(GL_COPY_READ_BUFFER, ring.buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, trails.buffer);
+    for (const TrailCopy& copy : trails.copies)
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, copy.offset, copy.slot * slotBytes, slotBytes);
+    trails.copies.clear();
+    if (trails.filled < 2)
+        return;
+
+    ProfileScope drawZone(ZONE_DRAW);
+    glUseProgram(trails.program);
+    glUniform1i(trails.headLoc, trails.head);
+    glUniform1i(trails.capacityLoc, trails.capacity);
+    glUniform1i(trails.bodiesLoc, (int)trails.bodies);
+    glUniform1i(trails.filledLoc, trails.filled);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, trails.texture);
+    glBindVertexArray(trails.VAO);
+
+    // Blended over the bodies without hiding anything drawn after
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDepthMask(GL_FALSE);
+    glDrawArraysInstanced(GL_LINE_STRIP, 0, trails.filled, (int)trails.bodies);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+    glUseProgram(shaderProgram);
+}
+
+void releaseTrails(OrbitTrails& trails)
+{
+    glDeleteVertexArrays(1, &trails.VAO);
+    glDeleteBuffers(1, &trails.buffer);
+    glDeleteTextures(1, &trails.texture);
+    OrbitTrails released;
+    released.capacity = trails.capacity;
+    released.stepDays = trails.stepDays;
+    trails = released;
+}
+
+// Generate the shared shapes: one octahedron for the Sun, Earth and Moon, scaled per body
+void registerSceneMeshes()
+{
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    generateOctahedronData(1.0f, vertices, indices);
+    octahedronMesh = registerMesh(meshPool, "octahedron", vertices, indices);
+
+    // Make circlce, at every detail level
+    for (int level = 0; level < SPHERE_LOD_LEVELS; ++level)
+    {
+        createIcosphere(1.0f, level, vertices, indices);
+        sphereLodMesh[level] = registerMesh(meshPool, "icosphere_" + std::to_string(level), vertices, indices);
+    }
+}
+
+// Compile the shaders and upload the meshes, needs a current GL context. Returns false if a
+// shader failed to build.
+bool setupScene()
+{
+    buildSolarSystemGraph();
+
+    // Compiling and linking shaders, or loading them from the cache
+    addShaderVariant(shaderManager, "scene", vertexShaderSource, fragmentShaderSource);
+    if (trails.capacity > 0)
+        addShaderVariant(shaderManager, "trails", vertexShaderSource, fragmentShaderSource, "#define TRAILS 1\n");
+    if (!buildShaderPrograms(shaderManager))
+        return false;
+    shaderProgram = shaderProgramOf(shaderManager, "scene");
+    std::cerr << "Shaders: " << shaderManager.loaded << " from cache, " << shaderManager.compiled
+        << " compiled in " << shaderManager.milliseconds << " ms" << std::endl;
+
+    // Block bindings are fixed once here, so drawing never looks anything up by name
+    glUniformBlockBinding(shaderProgram, glGetUniformBlockIndex(shaderProgram, "Camera"), CAMERA_BLOCK_BINDING);
+    if (trails.capacity > 0)
+    {
+        trails.program = shaderProgramOf(shaderManager, "trails");
+        glUniformBlockBinding(trails.program, glGetUniformBlockIndex(trails.program, "Camera"), CAMERA_BLOCK_BINDING);
+        trails.headLoc = glGetUniformLocation(trails.program, "trailHead");
+        trails.capacityLoc = glGetUniformLocation(trails.program, "trailCapacity");
+        trails.bodiesLoc = glGetUniformLocation(trails.program, "trailBodies");
+        trails.filledLoc = glGetUniformLocation(trails.program, "trailFilled");
+        glUseProgram(trails.program);
+        glUniform1i(glGetUniformLocation(trails.program, "trailPositions"), 0);
+        glUseProgram(0);
+    }
+
+    // Face culling and depth testing
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS); 
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+    glFrontFace(GL_CCW);
+
+    /*
+    // Used for task 1
+    // Octahedron geomertry
+    float vertices[] = {
+        // Top half
+        -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 0.0f,    // Face ABE
+        0.0f,  0.0f,  1.0f,  1.0f, 0.0f, 0.0f,
+        0.0f,  1.0f,  0.0f,  1.0f, 0.0f, 0.0f,
+
+        0.0f,  0.0f,  1.0f,  0.0f, 1.0f, 0.0f,    // Face BCE 
+        1.0f,  0.0f,  0.0f,  0.0f, 1.0f, 0.0f,
+        0.0f,  1.0f,  0.0f,  0.0f, 1.0f, 0.0f,
+
+        1.0f,  0.0f,  0.0f,  0.0f, 0.0f, 1.0f,    // Face CDE
+        0.0f,  0.0f, -1.0f,  0.0f, 0.0f, 1.0f,
+        0.0f,  1.0f,  0.0f,  0.0f, 0.0f, 1.0f,
+
+        0.0f,  0.0f, -1.0f,  0.5f, 0.5f, 0.5f,    // Face DAE
+       -1.0f,  0.0f,  0.0f,  0.5f, 0.5f, 0.5f,
+        0.0f,  1.0f,  0.0f,  0.5f, 0.5f, 0.5f,
+
+        // Bottom half
+        0.0f,  0.0f,  1.0f,  1.0f, 0.0f, 1.0f,    // Face BAF
+       -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 1.0f,
+        0.0f, -1.0f,  0.0f,  1.0f, 0.0f, 1.0f,
+
+        1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 0.0f,    // Face CBF
+        0.0f,  0.0f,  1.0f,  1.0f, 1.0f, 0.0f,
+        0.0f, -1.0f,  0.0f,  1.0f, 1.0f, 0.0f,
+
+        0.0f,  0.0f, -1.0f,  0.0f, 1.0f, 1.0f,    // Face DCF
+        1.0f,  0.0f,  0.0f,  0.0f, 1.0f, 1.0f,
+        0.0f, -1.0f,  0.0f,  0.0f, 1.0f, 1.0f,
+
+       -1.0f, -0.0f,  0.0f,  1.0f, 1.0f, 1.0f,    // Face ADF
+        0.0f,  0.0f, -1.0f,  1.0f, 1.0f, 1.0f,
+        0.0f, -1.0f,  0.0f,  1.0f, 1.0f, 1.0f
+    };
+
+    unsigned int indices[] = {
+    0, 1, 2,
+    3, 4, 5,
+    6, 7, 8,
+    9,10,11,
+    12,13,14,
+    15,16,17,
+    18,19,20,
+    21,22,23
+    };
+    */
+    
+    registerSceneMeshes();
+
+   
+    /*
+    // Used for task 1
+    unsigned int VBO, VAO, EBO;
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    */
+
+    // Used for task 2, 3, & 4
+    uploadMeshPool(meshPool);
+
+    glEnable(GL_DEPTH_TEST);
+    glClearColor(0.3f, 0.4f, 0.5f, 1.0f); // Background colour
+    return true;
+}
+
+// Fills the mesh pool's instance lists with the bodies that survive culling
+void gatherInstances(const glm::mat4& viewProjection, const glm::vec3& cameraWorldPos, float fovY, int height)
+{
+    ProfileScope cullingZone(ZONE_CULLING);
+
+    // Only bodies whose bounding sphere touches the view frustum are drawn
+    Frustum frustum = extractFrustum(viewProjection);
+    beginCullFrame();
+
+    // Sun, Earth and Moon share the octahedron
+    const uint32_t white = packColor(glm::vec4(1.0f));
+    clearInstances(meshPool);
+    const int bodyNodes[3] = { sunBodyNode, earthBodyNode, moonBodyNode };
+    const float bodySizes[3] = { (float)scene.sunSize, (float)scene.earthSize, (float)scene.moonSize };
+    bodyBounds.clear();
+    for (int b = 0; b < 3; ++b)
+        bodyBounds.push(worldPosition(sceneGraph, bodyNodes[b]), bodySizes[b] * 0.5f);
+    visibleBodies.clear();
+    cullSpheres(bodyBounds, frustum, visibleBodies);
+    std::vector<InstanceData>& octahedra = meshPool.meshes[octahedronMesh].instances;
+    for (uint32_t b : visibleBodies)
+        octahedra.push_back({ glm::scale(sceneGraph.world[bodyNodes[b]], glm::vec3(bodySizes[b])), white });
+
+    // Asteroids (N-body and ephemeris modes)
+    if (physicsMode != PhysicsMode::Analytic)
+    {
+        addAsteroidInstances(cameraWorldPos, frustum, fovY, height);
+        if (pickingEnabled)
+            updateBvh(asteroidBvh, asteroidBounds);
+    }
+}
+
+// Draw one frame of the solar system at the given day
+// Without draw only the CPU side runs, which keeps the LOD hysteresis state of skipped frames
+void renderScene(double day, int width, int height, bool draw = true)
+{
+    float aspect = (float)width / (float)std::max(height, 1);
+    if (draw)
+    {
+        beginGpuPass();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glUseProgram(shaderProgram);
+    }
+
+    updateSolarSystemTransforms(day);
+
+    // Camera positions / projection
+    /*
+    // Used for task 1
+    glm::mat4 view;
+    if (cameraPosition == 1)
+        view = glm::lookAt(glm::vec3(2.0f, 7.0f, 3.0f),
+            glm::vec3(0.0f, 0.0f, 0.0f),
+            glm::vec3(0.0f, 1.0f, 0.0f));
+    else
+        view = glm::lookAt(glm::vec3(-3.0f, -3.0f, -3.0f),
+            glm::vec3(0.0f, 0.0f, 0.0f),
+            glm::vec3(0.0f, 1.0f, 0.0f));
+    */
+
+    /*
+    // Used for task 2
+    glm::mat4 view;
+    if (cameraPosition == 1)
+        view = glm::lookAt(glm::vec3(0.0f, 0.0f, 120.0f),
+            glm::vec3(0.0f, 0.0f, 0.0f),
+            glm::vec3(0.0f, 1.0f, 0.0f));
+    else if (cameraPosition == 2)
+        view = glm::lookAt(glm::vec3(0.0f, 218.0f, 1.0f),
+            glm::vec3(0.0f, 0.0f, 0.0f),
+            glm::vec3(0.0f, 1.0f, 0.0f));
+    else if (cameraPosition == 3)
+        view = glm::lookAt(glm::vec3(-180.0f, 70.0f, 20.0f),
+            glm::vec3(0.0f, 0.0f, 0.0f),
+            glm::vec3(0.0f, 1.0f, 0.0f));
+    else if (cameraPosition == 4)
+        view = glm::lookAt(glm::vec3(-120.0f, 100.0f, 80.0f),
+            glm::vec3(0.0f, 0.0f, 0.0f),
+            glm::vec3(0.0f, 1.0f, 0.0f));
+    else if (cameraPosition == 5)
+        view = glm::lookAt(glm::vec3(70.0f, 80.0f, 90.0f),
+            glm::vec3(45.0f, 0.0f, 0.0f),
+            glm::vec3(0.0f, 1.0f, 0.0f));
+    */
+
+    /*
+    // Used for task 3
+    glm::mat4 view = glm::lookAt(glm::vec3(60.0f, 30.0f, 80.0f),
+        glm::vec3(30.0f, 0.0f, 0.0f), // Manually changed to look at either the earth's center or sun's center
+        glm::vec3(0.0f, 1.0f, 0.0f));
+    */
+
+    // Earth and Moon positions from the scene graph
+    // Used for task 4
+    glm::vec3 earthPos = worldPosition(sceneGraph, earthNode);
+    glm::vec3 moonPos = worldPosition(sceneGraph, moonNode);
+
+    glm::vec3 cameraWorldPos(30.0f, 20.0f, 90.0f); 
+    glm::vec3 lookTarget(0.0f, 0.0f, 0.0f);
+
+    if (cameraPosition == 1) {
+        lookTarget = worldPosition(sceneGraph, sunNode);
+    }
+    else if (cameraPosition == 2) {
+        lookTarget = earthPos; 
+    }
+    else if (cameraPosition == 3) {
+        lookTarget = moonPos;  
+    }
+    // An asteroid picked with the mouse is followed until a number key is pressed
+    if (followedAsteroid >= 0 && physicsMode != PhysicsMode::Analytic && nbodyFirstAsteroid + (size_t)followedAsteroid < nbodyCount())
+        lookTarget = nbodyPosition(nbodyFirstAsteroid + followedAsteroid) * (float)scene.earthOrbitRadius;
+
+    glm::mat4 view = glm::lookAt(cameraWorldPos, lookTarget, glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), aspect, 0.1f, 1000.0f);
+    pickViewProjection = projection * view;
+
+    //glm::mat4 model = glm::mat4(1.0f); // Used for task 1
+
+    /*
+    // Used for task 1
+    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model)); 
+    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view)); 
+    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection)); 
+    glBindVertexArray(VAO); 
+    glDrawElements(GL_TRIANGLES, 24, GL_UNSIGNED_INT, 0);
+    */
+
+    /*
+    // Used for task 2
+    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+
+    // Sun
+    glBindVertexArray(VAO_sun);
+    glm::mat4 model = glm::mat4(1.0f);
+    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    glDrawElements(GL_TRIANGLES, indices_sun.size(), GL_UNSIGNED_INT, 0);
+
+    // Earth
+    glBindVertexArray(VAO_earth);
+    model = glm::mat4(1.0f);
+    model = glm::translate(model, glm::vec3(30.0f, 0.0f, 0.0f));
+    model = glm::rotate(model, glm::radians(23.4f), glm::vec3(0.0f, 0.0f, 1.0f));
+    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    glDrawElements(GL_TRIANGLES, indices_earth.size(), GL_UNSIGNED_INT, 0);
+
+    // Moon
+    glBindVertexArray(VAO_moon);
+    model = glm::mat4(1.0f);
+    model = glm::translate(model, glm::vec3(45.0f, 0.0f, 0.0f));
+    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    glDrawElements(GL_TRIANGLES, indices_moon.size(), GL_UNSIGNED_INT, 0);
+    */
+
+
+    // Used for task 3
+    gatherInstances(projection * view, cameraWorldPos, glm::radians(45.0f), height);
+    recordTrails(trails, day);
+    if (!draw)
+        return;
+    beginFrameRing(frameRing, optionalGL.uniformBufferAlignment + 2 * sizeof(glm::mat4) + meshPoolStreamBytes(meshPool)
+        + trailStreamBytes(trails));
+    writeCameraBlock(frameRing, view, projection);
+    writeTrails(trails, frameRing);
+    drawMeshPool(meshPool, frameRing);
+    drawTrails(trails, frameRing);
+    endFrameRing(frameRing);
+    endGpuPass();
+
+    // Circle for fun
+    /*
+    glBindVertexArray(VAO_sphere);
+    glm::mat4 model_circle = glm::mat4(1.0f);
+    model_circle = glm::translate(model_circle, glm::vec3(20.0f, 20.0f, 0.0f)); // center position
+    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model_circle));
+    glDrawElements(GL_TRIANGLES, indices_sphere.size(), GL_UNSIGNED_INT, 0);
+    */
+}
+
+void releaseScene()
+{
+    // Releasing resources 
+    /*
+    // Used for task 1
+    glDeleteVertexArrays(1, &VAO); 
+    glDeleteBuffers(1, &VBO); 
+    glDeleteBuffers(1, &EBO); 
+    glDeleteProgram(shaderProgram);
+    */
+
+    // Used for task 2, 3, & 4
+    releaseMeshPool(meshPool);
+    releaseFrameRing(frameRing);
+    releaseTrails(trails);
+    releaseShaderPrograms(shaderManager);
+    shaderProgram = 0;
+    closeEphemeris(ephemeris);
+    closeRecording(recording);
+}
+
+// Command line options
+// Headless mode renders a day range into an offscreen framebuffer and exits, for batch jobs on machines without a display
+struct RenderOptions
+{
+    bool headless = false;
+    double startDay = 0.0;
+    double endDay = 365.0;
+    double stepDays = 1.0 / 96;
+    int width = 1920;
+    int height = 1080;
+    int camera = 1;
+    std::string outputPrefix = "frame";
+    CaptureFormat format = CaptureFormat::PPM;
+    std::string streamPath;     // empty writes numbered files
+    StreamFormat streamFormat = StreamFormat::Y4M;
+    int fps = 30;
+    int shards = 1;             // headless worker processes, each with its own context
+    int trails = 0;             // orbit trail samples per body, 0 for none
+    double trailStep = 1.0;     // days between trail samples
+
+    PhysicsMode physics = PhysicsMode::Analytic;
+    Integrator integrator = Integrator::Yoshida4;
+    int asteroids = 0;
+    double physicsStep = 1.0 / 24;
+    ForceSolver solver = ForceSolver::Direct;
+    double theta = 0.5;
+    bool pipeline = true;       // step N-body physics on its own thread
+    int threads = 0;            // job system threads, 0 for one per hardware thread
+    double warp = 1.0;          // windowed mode only
+    std::string ephemerisPath;  // play positions back from a baked ephemeris
+    std::string replayPath;     // play positions back from a --record file
+    std::string profilePrefix;  // empty disables the profiler
+    std::string shaderCache = "shader_cache"; // directory of linked program binaries, empty disables
+    std::string scenePath;      // scene parameters and body catalog
+    std::string saveScenePath;  // write the loaded scene as .ssbin and exit
+
+    std::string bakeEphemerisPath;
+    std::string recordPath;
+    int keyframeInterval = 32;
+    double segmentDays = 8.0;
+    int degree = 12;
+
+    bool meshReport = false;
+    bool benchSuite = false;
+    std::string benchFilter;    // only benchmarks whose name contains this
+    std::string benchBaseline;  // CSV of an earlier --bench-suite run to compare against
+    double benchTolerance = 0.10;
+    bool benchGravity = false;
+    std::vector<int> benchSizes = { 1000, 4000, 16000, 64000 };
+    std::vector<double> benchThetas = { 0.3, 0.5, 0.7, 1.0 };
+};
+
+void printUsage(const char* program)
+{
+    std::cout << "Usage: " << program << " [--headless] [--days START END] [--step DAYS]\n"
+        << "       [--size WIDTHxHEIGHT] [--camera 1|2|3] [--output PREFIX] [--format ppm|qoi]\n"
+        << "       [--stream PATH|-] [--format y4m|rgb] [--fps N] [--shards N] [--trails N] [--trail-step DAYS]\n"
+        << "  --headless  render offscreen without a window and exit when done\n"
+        << "  --days      day range to render (default 0 365)\n"
+        << "  --step      days advanced per frame (default 1/96)\n"
+        << "  --size      output resolution (default 1920x1080)\n"
+        << "  --camera    1 = Sun, 2 = Earth, 3 = Moon\n"
+        << "  --output    frame file prefix, frames are written as PREFIX_000000.ppm\n"
+        << "  --format    ppm (binary P6, default) or qoi for files, y4m (default) or rgb for streams\n"
+        << "  --stream    write frames continuously to a pipe or file instead, - for stdout\n"
+        << "  --fps       frame rate recorded in the Y4M header (default 30)\n"
+        << "  --shards    render headless frames in N processes, each with its own context (default 1)\n"
+        << "  --trails    draw each body's last N positions as a fading trail (default 0, none)\n"
+        << "  --trail-step  days between trail positions (default 1)\n"
+        << "  --shader-cache DIR|off  where linked shader programs are cached (default shader_cache)\n"
+        << "  --scene     body sizes, orbits and periods plus a body catalog, from .csv, .json or .ssbin\n"
+        << "  --profile   record CPU zones and GPU pass times, written to PREFIX.json (Chrome trace) and PREFIX.csv\n"
+        << "Physics: [--physics analytic|nbody|kepler] [--integrator leapfrog|yoshida] [--asteroids N] [--physics-step DAYS]\n"
+        << "  --physics       analytic circular orbits (default), N-body gravity or kepler (elliptical two-body orbits)\n"
+        << "  --integrator    symplectic integrator for N-body mode (default yoshida)\n"
+        << "  --asteroids     main belt bodies added in N-body and Kepler modes (default 0)\n"
+        << "  --physics-step  fixed integration step in days (default 1/24)\n"
+        << "  --solver        direct (default) or barnes-hut force summation\n"
+        << "  --theta         Barnes-Hut opening angle (default 0.5)\n"
+        << "  --serial        step N-body physics on the render thread instead of its own\n"
+        << "  --threads       threads for parallel work such as gravity, culling and encoding (default: all)\n"
+        << "  --ephemeris     play positions back from a file made by --bake-ephemeris instead of simulating\n"
+        << "  --replay        play positions back from a file made by --record instead of simulating\n"
+        << "  --warp          initial time warp of the window, 1 to 1e6 times 1/96 day per 60 Hz frame (+ and - keys change it)\n"
+        << "Benchmarks: --bench-gravity [N,N,...]  Barnes-Hut against direct summation, as CSV\n"
+        << "            --mesh-report               vertex memory and per-frame bandwidth, as CSV (uses --asteroids)\n"
+        << "            --bench-suite [--bench-filter TEXT] [--bench-baseline FILE] [--bench-tolerance FRACTION]\n"
+        << "                mesh, transform, physics, capture and whole frame timings as CSV; with a baseline,\n"
+        << "                exits with 1 if any median is slower by more than the tolerance (default 0.10)\n"
+        << "Tools: --bake-ephemeris FILE [--segment DAYS] [--degree N]  integrate --days with the physics options above\n"
+        << "       and store Chebyshev coefficients per segment (default 8 days, degree 12)\n"
+        << "       --record FILE [--keyframe STEPS]  simulate --days every --step with the physics options above and\n"
+        << "       store every position, compressed, with a keyframe every STEPS steps (default 32)\n"
+        << "       --save-scene FILE  write the --scene (or default) scene as binary .ssbin" << std::endl;
+}
+
+bool parseCommandLine(int argc, char** argv, RenderOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--headless")
+            options.headless = true;
+        else if (arg == "--days" && i + 2 < argc)
+        {
+            options.startDay = std::atof(argv[++i]);
+            options.endDay = std::atof(argv[++i]);
+        }
+        else if (arg == "--step" && hasValue)
+            options.stepDays = std::atof(argv[++i]);
+        else if (arg == "--size" && hasValue)
+        {
+            if (std::sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2)
+                return false;
+        }
+        else if (arg == "--camera" && hasValue)
+            options.camera = std::atoi(argv[++i]);
+        else if (arg == "--output" && hasValue)
+            options.outputPrefix = argv[++i];
+        else if (arg == "--format" && hasValue)
+        {
+            std::string format = argv[++i];
+            if (format == "ppm")
+                options.format = CaptureFormat::PPM;
+            else if (format == "qoi")
+                options.format = CaptureFormat::QOI;
+            else if (format == "y4m")
+                options.streamFormat = StreamFormat::Y4M;
+            else if (format == "rgb")
+                options.streamFormat = StreamFormat::RawRGB;
+            else
+            {
+                std::cerr << "Unknown format " << format << ", expected ppm or qoi (files) or y4m or rgb (--stream)" << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--stream" && hasValue)
+            options.streamPath = argv[++i];
+        else if (arg == "--fps" && hasValue)
+            options.fps = std::atoi(argv[++i]);
+        else if (arg == "--physics" && hasValue)
+        {
+            std::string physics = argv[++i];
+            if (physics == "analytic")
+                options.physics = PhysicsMode::Analytic;
+            else if (physics == "nbody")
+                options.physics = PhysicsMode::NBody;
+            else if (physics == "kepler")
+                options.physics = PhysicsMode::Kepler;
+            else
+                return false;
+        }
+        else if (arg == "--integrator" && hasValue)
+        {
+            std::string integrator = argv[++i];
+            if (integrator == "leapfrog")
+                options.integrator = Integrator::Leapfrog;
+            else if (integrator == "yoshida")
+                options.integrator = Integrator::Yoshida4;
+            else
+                return false;
+        }
+        else if (arg == "--asteroids" && hasValue)
+            options.asteroids = std::atoi(argv[++i]);
+        else if (arg == "--physics-step" && hasValue)
+            options.physicsStep = std::atof(argv[++i]);
+        else if (arg == "--solver" && hasValue)
+        {
+            std::string solver = argv[++i];
+            if (solver == "direct")
+                options.solver = ForceSolver::Direct;
+            else if (solver == "barnes-hut")
+                options.solver = ForceSolver::BarnesHut;
+            else
+                return false;
+        }
+        else if (arg == "--theta" && hasValue)
+            options.theta = std::atof(argv[++i]);
+        else if (arg == "--shader-cache" && hasValue)
+        {
+            options.shaderCache = argv[++i];
+            if (options.shaderCache == "off")
+                options.shaderCache.clear();
+        }
+        else if (arg == "--shards" && hasValue)
+        {
+            options.shards = std::atoi(argv[++i]);
+            if (options.shards < 1)
+                return false;
+        }
+        else if (arg == "--trails" && hasValue)
+            options.trails = std::atoi(argv[++i]);
+        else if (arg == "--trail-step" && hasValue)
+            options.trailStep = std::atof(argv[++i]);
+        else if (arg == "--scene" && hasValue)
+            options.scenePath = argv[++i];
+        else if (arg == "--save-scene" && hasValue)
+            options.saveScenePath = argv[++i];
+        else if (arg == "--serial")
+            options.pipeline = false;
+        else if (arg == "--threads" && hasValue)
+            options.threads = std::atoi(argv[++i]);
+        else if (arg == "--warp" && hasValue)
+            options.warp = std::atof(argv[++i]);
+        else if (arg == "--ephemeris" && hasValue)
+        {
+            options.ephemerisPath = argv[++i];
+            options.physics = PhysicsMode::Ephemeris;
+        }
+        else if (arg == "--replay" && hasValue)
+        {
+            options.replayPath = argv[++i];
+            options.physics = PhysicsMode::Replay;
+        }
+        else if (arg == "--record" && hasValue)
+            options.recordPath = argv[++i];
+        else if (arg == "--keyframe" && hasValue)
+            options.keyframeInterval = std::atoi(argv[++i]);
+        else if (arg == "--bake-ephemeris" && hasValue)
+            options.bakeEphemerisPath = argv[++i];
+        else if (arg == "--profile" && hasValue)
+            options.profilePrefix = argv[++i];
+        else if (arg == "--segment" && hasValue)
+            options.segmentDays = std::atof(argv[++i]);
+        else if (arg == "--degree" && hasValue)
+            options.degree = std::atoi(argv[++i]);
+        else if (arg == "--mesh-report")
+            options.meshReport = true;
+        else if (arg == "--bench-suite")
+            options.benchSuite = true;
+        else if (arg == "--bench-filter" && hasValue)
+            options.benchFilter = argv[++i];
+        else if (arg == "--bench-baseline" && hasValue)
+            options.benchBaseline = argv[++i];
+        else if (arg == "--bench-tolerance" && hasValue)
+            options.benchTolerance = std::atof(argv[++i]);
+        else if (arg == "--bench-gravity")
+        {
+            options.benchGravity = true;
+            if (hasValue && argv[i + 1][0] != '-')
+            {
+                options.benchSizes.clear();
+                for (const char* p = argv[++i]; *p; )
+                {
+                    char* end;
+                    long count = std::strtol(p, &end, 10);
+                    if (end == p || count <= 0)
+                        return false;
+                    options.benchSizes.push_back((int)count);
+                    p = *end == ',' ? end + 1 : end;
+                }
+            }
+        }
+        else
+        {
+            std::cout << "Unknown or incomplete option " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (options.width <= 0 || options.height <= 0 || options.stepDays <= 0.0 || options.endDay < options.startDay)
+    {
+        std::cout << "Invalid day range, step or resolution" << std::endl;
+        return false;
+    }
+    if (options.asteroids < 0 || options.physicsStep <= 0.0 || options.theta <= 0.0)
+    {
+        std::cout << "Invalid asteroid count or physics step" << std::endl;
+        return false;
+    }
+    if (options.format == CaptureFormat::QOI && !options.streamPath.empty())
+    {
+        std::cerr << "--format qoi writes numbered files and cannot be streamed, use y4m or rgb with --stream" << std::endl;
+        return false;
+    }
+    if (options.threads < 0)
+    {
+        std::cout << "Thread count cannot be negative" << std::endl;
+        return false;
+    }
+    if (options.trails < 0 || options.trailStep <= 0.0)
+    {
+        std::cout << "Invalid trail length or step" << std::endl;
+        return false;
+    }
+    if (options.trails > MAX_TRAIL_SAMPLES)
+    {
+        std::cout << "--trails is limited to " << MAX_TRAIL_SAMPLES << " samples" << std::endl;
+        return false;
+    }
+    if (options.fps <= 0)
+    {
+        std::cout << "Frame rate must be positive" << std::endl;
+        return false;
+    }
+    if (options.camera < 1 || options.camera > 3)
+    {
+        std::cout << "Camera must be 1, 2 or 3" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+#ifdef __linux__
+// Surfaceless EGL context on Mesa (llvmpipe works without a GPU or display)
+struct HeadlessContext
+{
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+};
+
+bool createHeadlessContext(HeadlessContext& headless)
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (eglGetPlatformDisplayEXT)
+        headless.display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (headless.display == EGL_NO_DISPLAY)
+        headless.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (headless.display == EGL_NO_DISPLAY || !eglInitialize(headless.display, NULL, NULL))
+    {
+        std::cout << "Failed to initialize EGL display" << std::endl;
+        return false;
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API))
+    {
+        std::cout << "EGL has no desktop OpenGL support" << std::endl;
+        return false;
+    }
+
+    // No surface is ever created, all rendering goes to a framebuffer object
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(headless.display, configAttribs, &config, 1, &configCount) || configCount == 0)
+    {
+        std::cout << "Failed to choose EGL config" << std::endl;
+        return false;
+    }
+
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    headless.context = eglCreateContext(headless.display, config, EGL_NO_CONTEXT, contextAttribs);
+    if (headless.context == EGL_NO_CONTEXT)
+    {
+        std::cout << "Failed to create EGL OpenGL 3.3 core context" << std::endl;
+        return false;
+    }
+
+    if (!eglMakeCurrent(headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, headless.context))
+    {
+        std::cout << "Failed to make surfaceless EGL context current" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void destroyHeadlessContext(HeadlessContext& headless)
+{
+    if (headless.display == EGL_NO_DISPLAY)
+        return;
+    eglMakeCurrent(headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (headless.context != EGL_NO_CONTEXT)
+        eglDestroyContext(headless.display, headless.context);
+    eglTerminate(headless.display);
+}
+#endif
+
+// Offscreen render target
+struct OffscreenTarget
+{
+    unsigned int FBO = 0, colorRBO = 0, depthRBO = 0;
+};
+
+bool createOffscreenTarget(OffscreenTarget& target, int width, int height)
+{
+    glGenFramebuffers(1, &target.FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.FBO);
+
+    glGenRenderbuffers(1, &target.colorRBO);
+    glBindRenderbuffer(GL_RENDERBUFFER, target.colorRBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.colorRBO);
+
+    glGenRenderbuffers(1, &target.depthRBO);
+    glBindRenderbuffer(GL_RENDERBUFFER, target.depthRBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, target.depthRBO);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cout << "Offscreen framebuffer is incomplete" << std::endl;
+        return false;
+    }
+
+    glViewport(0, 0, width, height);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    return true;
+}
+
+void releaseOffscreenTarget(OffscreenTarget& target)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteRenderbuffers(1, &target.colorRBO);
+    glDeleteRenderbuffers(1, &target.depthRBO);
+    glDeleteFramebuffers(1, &target.FBO);
+}
+
+bool configureSimulation(const RenderOptions& options)
+{
+    physicsMode = options.physics;
+    if (physicsMode == PhysicsMode::NBody)
+    {
+        buildSolarSystemNBody(options.asteroids, options.integrator, options.physicsStep);
+        addCatalogBodies(nbody, sceneCatalog);
+        nbody.solver = options.solver;
+        nbody.theta = options.theta;
+        std::cout << "N-body mode: " << nbody.mass.size() << " bodies" << std::endl;
+    }
+    else if (physicsMode == PhysicsMode::Kepler)
+    {
+        buildSolarSystemKepler(options.asteroids, sceneCatalog);
+        std::cout << "Kepler mode: " << keplerOrbits.e.size() << " orbits";
+        if (keplerOrbits.unbound > 0)
+            std::cout << ", " << keplerOrbits.unbound << " unbound catalog bodies held in place";
+        std::cout << std::endl;
+    }
+    else if (physicsMode == PhysicsMode::Ephemeris)
+    {
+        if (!loadEphemerisBodies(options.ephemerisPath))
+            return false;
+        std::cout << "Ephemeris mode: " << nbody.mass.size() << " bodies, days " << ephemeris.header->startDay
+            << " to " << ephemerisEndDay(*ephemeris.header) << std::endl;
+    }
+    else if (physicsMode == PhysicsMode::Replay)
+    {
+        if (!loadRecordingBodies(options.replayPath))
+            return false;
+        std::cout << "Replay mode: " << nbody.mass.size() << " bodies, " << recording.header->stepCount
+            << " steps, days " << recording.header->startDay << " to " << recordingEndDay(*recording.header) << std::endl;
+    }
+    return true;
+}
+
+long long headlessFrameCount(const RenderOptions& options)
+{
+    return (long long)std::floor((options.endDay - options.startDay) / options.stepDays + 1e-9) + 1;
+}
+
+// One worker of a sharded run (see runShardedHeadless)
+struct HeadlessShard
+{
+    int index = 0;
+    int count = 1;
+    int frameFd = -1; // where its frames go, raw
+};
+
+// Render every frame of the day range as fast as the backend allows, then exit.
+// A shard renders frames index, index + count, ... and sends them to frameFd unencoded.
+int runHeadless(const RenderOptions& options, const HeadlessShard& shard = HeadlessShard())
+{
+#ifdef __linux__
+    // stdout carries the video, so log to stderr instead (shards inherit that from their parent)
+    if (options.streamPath == "-" && shard.count == 1)
+        std::cout.rdbuf(std::cerr.rdbuf());
+
+    HeadlessContext headless;
+    if (!createHeadlessContext(headless))
+    {
+        destroyHeadlessContext(headless);
+        return -1;
+    }
+
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+    {
+        std::cout << "Failed to initialize GLAD" << std::endl;
+        destroyHeadlessContext(headless);
+        return -1;
+    }
+    loadOptionalGL((GLADloadproc)eglGetProcAddress);
+    std::cout << "Headless renderer: " << glGetString(GL_RENDERER) << std::endl;
+
+    OffscreenTarget target;
+    if (!createOffscreenTarget(target, options.width, options.height))
+    {
+        releaseOffscreenTarget(target);
+        destroyHeadlessContext(headless);
+        return -1;
+    }
+
+    if (!configureSimulation(options))
+    {
+        releaseOffscreenTarget(target);
+        destroyHeadlessContext(headless);
+        return -1;
+    }
+    if (!setupScene())
+    {
+        releaseScene();
+        releaseOffscreenTarget(target);
+        destroyHeadlessContext(headless);
+        return -1;
+    }
+    cameraPosition = options.camera;
+    std::string profilePrefix = options.profilePrefix;
+    if (!profilePrefix.empty() && shard.count > 1)
+        profilePrefix += "_shard" + std::to_string(shard.index);
+    if (!profilePrefix.empty())
+        startProfiler();
+
+    long long frameCount = headlessFrameCount(options);
+    auto startTime = std::chrono::steady_clock::now();
+
+    FrameCapture capture;
+    if (shard.count > 1)
+    {
+        capture.writer.streamFd = shard.frameFd;
+        capture.writer.streamFormat = StreamFormat::RawRGBA;
+        capture.writer.maxQueued = 2; // the pipe to the encoding process already buffers
+    }
+    else if (!options.streamPath.empty())
+    {
+        capture.writer.streamFd = openFrameStream(options.streamPath);
+        capture.writer.streamFormat = options.streamFormat;
+        capture.writer.streamFps = options.fps;
+        if (capture.writer.streamFd < 0)
+        {
+            std::cout << "Failed to open frame stream " << options.streamPath << std::endl;
+            releaseScene();
+            releaseOffscreenTarget(target);
+            destroyHeadlessContext(headless);
+            return -1;
+        }
+    }
+    startFrameCapture(capture, options.format);
+
+    // A shard still runs the CPU side of the frames it skips when asteroids or trails are drawn,
+    // because LOD levels and trail samples depend on the frames before. Otherwise it only visits
+    // its own frames.
+    bool replay = shard.count > 1 && (trails.capacity > 0 ||
+        (physicsMode != PhysicsMode::Analytic && nbodyCount() > (size_t)nbodyFirstAsteroid));
+    long long firstFrame = replay ? 0 : shard.index, frameStride = replay ? 1 : shard.count;
+
+    // The thread simulates the next frame while this one is drawn
+    bool pipelined = physicsMode == PhysicsMode::NBody && options.pipeline;
+    if (pipelined)
+        startSimulationThread(simulationThread, options.startDay + firstFrame * options.stepDays);
+
+    char frameName[32];
+    long long framesRendered = 0;
+    for (long long frame = firstFrame; frame < frameCount; frame += frameStride)
+    {
+        bool own = frame % shard.count == shard.index;
+        beginProfileFrame();
+        double day = options.startDay + frame * options.stepDays;
+        if (pipelined)
+        {
+            waitForSimulation(simulationThread, day);
+            if (frame + frameStride < frameCount)
+                simulationThread.requestedDay.store(options.startDay + (frame + frameStride) * options.stepDays);
+        }
+        renderScene(day, options.width, options.height, own);
+
+        if (own)
+        {
+            ProfileScope captureZone(ZONE_CAPTURE);
+            std::snprintf(frameName, sizeof(frameName), "_%06lld", frame);
+            captureFrame(capture, options.outputPrefix + frameName, options.width, options.height);
+            framesRendered++;
+            pollFrameCapture(capture);
+        }
+        endProfileFrame();
+        if (frameWriterFailed(capture.writer))
+            break;
+    }
+    stopSimulationThread(simulationThread);
+    finishFrameCapture(capture);
+    closeFrameStream(capture.writer.streamFd);
+    bool failed = frameWriterFailed(capture.writer);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    if (shard.count > 1)
+        std::cout << "Shard " << shard.index << ": ";
+    std::cout << "Rendered " << framesRendered << " frames in " << seconds << " s ("
+        << framesRendered / seconds << " fps)" << std::endl;
+    if (physicsMode == PhysicsMode::NBody)
+        std::cout << "N-body: " << nbody.steps << " steps of " << nbody.mass.size() << " bodies" << std::endl;
+    printCullStats();
+    std::cout << "Frame ring: " << FRAME_RING_REGIONS << " x " << frameRing.regionSize / 1024 << " KB, "
+        << (frameRing.persistent ? "persistent" : "mapped per frame") << ", " << frameRing.fenceWaits
+        << " fence waits" << std::endl;
+    if (!finishProfiler(profilePrefix))
+        failed = true;
+
+    releaseScene();
+    releaseOffscreenTarget(target);
+    destroyHeadlessContext(headless);
+    return failed ? -1 : 0;
+#else
+    std::cout << "Headless mode needs EGL and is only available on Linux" << std::endl;
+    return -1;
+#endif
+}
+
+// Sharded headless rendering
+// Worker processes, each with its own EGL context and its own copy of the scene, render the
+// frames dealt to them round robin: shard k gets frames k, k + shards, ... Dealing frames out
+// rather than contiguous ranges keeps every shard close to the frame being written, so the parent
+// can read the frames back in order, one pipe per shard, into its single bounded encoder queue.
+// A full queue stops the reads and a full pipe stops that shard. Processes rather than threads
+// because the renderer keeps its state in globals. Frames match a serial run byte for byte.
+int runShardedHeadless(const RenderOptions& options)
+{
+#ifdef __linux__
+    if (options.streamPath == "-")
+        std::cout.rdbuf(std::cerr.rdbuf());
+    long long frameCount = headlessFrameCount(options);
+    int shards = (int)std::min<long long>(options.shards, frameCount);
+    size_t threads = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    size_t shardThreads = std::max<size_t>(1, threads / shards);
+
+    int streamFd = -1;
+    if (!options.streamPath.empty())
+    {
+        streamFd = openFrameStream(options.streamPath);
+        if (streamFd < 0)
+        {
+            std::cout << "Failed to open frame stream " << options.streamPath << std::endl;
+            return -1;
+        }
+    }
+    std::signal(SIGPIPE, SIG_IGN); // a shard whose reader is gone should fail its write, not die
+
+    // fork copies only the calling thread, so no job worker may be running
+    stopJobSystem();
+    std::cout.flush();
+    std::vector<int> frameFds;
+    std::vector<pid_t> workers;
+    for (int k = 0; k < shards; ++k)
+    {
+        int fds[2];
+        if (pipe(fds) != 0)
+        {
+            std::cout << "Failed to create a pipe for shard " << k << std::endl;
+            break;
+        }
+        fcntl(fds[0], F_SETPIPE_SZ, 1 << 20); // fewer wakeups per frame, fine if refused
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(fds[0]);
+            for (int fd : frameFds)
+                close(fd);
+            closeFrameStream(streamFd);
+            // One shard's setup messages are enough; the others hold theirs back and print them
+            // only if they fail, so the reason is not lost
+            std::ostringstream heldOutput;
+            if (k > 0)
+                std::cout.rdbuf(heldOutput.rdbuf());
+            // Mesa's llvmpipe otherwise starts a rasteriser thread per core in every shard
+            setenv("LP_NUM_THREADS", std::to_string(shardThreads).c_str(), 0);
+            startJobSystem(shardThreads);
+            HeadlessShard shard;
+            shard.index = k;
+            shard.count = shards;
+            shard.frameFd = fds[1];
+            int status = runHeadless(options, shard);
+            if (k > 0 && status != 0)
+                std::cerr << "Shard " << k << ":\n" << heldOutput.str() << std::flush;
+            std::cout.flush();
+            _exit(status == 0 ? 0 : 1);
+        }
+        close(fds[1]);
+        if (pid < 0)
+        {
+            close(fds[0]);
+            std::cout << "Failed to start shard " << k << std::endl;
+            break;
+        }
+        frameFds.push_back(fds[0]);
+        workers.push_back(pid);
+    }
+    startJobSystem(options.threads);
+    bool failed = (int)workers.size() < shards;
+    auto startTime = std::chrono::steady_clock::now();
+
+    FrameWriter writer;
+    writer.streamFd = streamFd;
+    writer.streamFormat = options.streamFormat;
+    writer.streamFps = options.fps;
+    startFrameWriter(writer, options.format);
+    size_t frameBytes = (size_t)options.width * options.height * 4;
+    char frameName[32];
+    long long framesWritten = 0;
+    for (long long frame = 0; frame < frameCount && !failed; ++frame)
+    {
+        CapturedFrame captured;
+        captured.pixels = acquireFrameBuffer(writer, frameBytes);
+        if (!readAll(frameFds[frame % shards], captured.pixels.data(), frameBytes))
+        {
+            std::cout << "Shard " << frame % shards << " stopped before frame " << frame << std::endl;
+            failed = true;
+            break;
+        }
+        captured.width = options.width;
+        captured.height = options.height;
+        std::snprintf(frameName, sizeof(frameName), "_%06lld", frame);
+        captured.file_name = options.outputPrefix + frameName + captureExtension(options.format);
+        submitFrame(writer, std::move(captured));
+        framesWritten++;
+        failed = frameWriterFailed(writer);
+    }
+    stopFrameWriter(writer);
+    closeFrameStream(streamFd);
+    failed = failed || frameWriterFailed(writer);
+
+    // Closing the pipes ends any shard still writing
+    for (int fd : frameFds)
+        close(fd);
+    for (size_t k = 0; k < workers.size(); ++k)
+    {
+        int status = 0;
+        if (waitpid(workers[k], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            if (!failed)
+                std::cout << "Shard " << k << " failed" << std::endl;
+            failed = true;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "Rendered " << framesWritten << " frames on " << shards << " shards of " << shardThreads
+        << " threads in " << seconds << " s (" << framesWritten / seconds << " fps)" << std::endl;
+    return failed ? -1 : 0;
+#else
+    std::cout << "Headless mode needs EGL and is only available on Linux" << std::endl;
+    return -1;
+#endif
+}
+
+// Gravity benchmark
+// Compares Barnes-Hut against direct summation on a Plummer sphere of equal masses (a self
+// gravitating cluster, where far field errors actually show). Errors are relative to the exact
+// direct sum over a sample of bodies; for large N the direct time is extrapolated from that sample.
+void buildPlummerSphere(NBodySystem& system, int count, unsigned int seed)
+{
+    system = NBodySystem();
+    system.G = 1.0;
+    system.softening2 = 1e-6;
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for (int i = 0; i < count; ++i)
+    {
+        double u = std::max(uniform(rng), 1e-6);
+        double r = std::min(20.0, 1.0 / std::sqrt(std::pow(u, -2.0 / 3.0) - 1.0));
+        double cosTheta = 2.0 * uniform(rng) - 1.0, phi = 2.0 * 3.14159265358979323846 * uniform(rng);
+        double sinTheta = std::sqrt(1.0 - cosTheta * cosTheta);
+        addBody(system, glm::dvec3(r * sinTheta * std::cos(phi), r * sinTheta * std::sin(phi), r * cosTheta),
+            glm::dvec3(0.0, 0.0, 0.0), 1.0 / count);
+    }
+}
+
+int runEphemerisBake(const RenderOptions& options)
+{
+    if (options.endDay <= options.startDay || options.segmentDays <= 0.0 || options.degree < 1 || options.degree > 63)
+    {
+        std::cout << "Ephemeris needs END > START, a positive --segment and --degree between 1 and 63" << std::endl;
+        return -1;
+    }
+    buildSolarSystemNBody(options.asteroids, options.integrator, options.physicsStep);
+    addCatalogBodies(nbody, sceneCatalog);
+    nbody.solver = options.solver;
+    nbody.theta = options.theta;
+    auto start = std::chrono::steady_clock::now();
+    if (!bakeEphemeris(options.bakeEphemerisPath, nbody, nbodyFirstAsteroid,
+        options.startDay, options.endDay, options.segmentDays, options.degree))
+        return -1;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Wrote " << options.bakeEphemerisPath << " in " << seconds << " s" << std::endl;
+    return 0;
+}
+
+// Simulates the day range once and stores every step, with any physics mode (analytic becomes
+// N-body, since its orbits need no simulating)
+int runRecording(const RenderOptions& options)
+{
+    if (options.keyframeInterval < 1)
+    {
+        std::cout << "--keyframe must be at least 1" << std::endl;
+        return -1;
+    }
+    RenderOptions source = options;
+    if (source.physics == PhysicsMode::Analytic)
+        source.physics = PhysicsMode::NBody;
+    if (!configureSimulation(source))
+        return -1;
+    RecordingWriter writer;
+    if (!beginRecording(writer, options.recordPath, nbody.mass, nbodyFirstAsteroid, options.startDay,
+        options.stepDays, options.keyframeInterval))
+        return -1;
+
+    auto start = std::chrono::steady_clock::now();
+    long long steps = headlessFrameCount(options);
+    size_t bodies = nbody.mass.size();
+    std::vector<double> positions(bodies * 3);
+    for (long long step = 0; step < steps; ++step)
+    {
+        updateBodyPositions(options.startDay + step * options.stepDays);
+        parallelFor(bodies, 16384, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                glm::dvec3 p = nbodyInterpolated((int)i);
+                positions[i] = p.x;
+                positions[bodies + i] = p.y;
+                positions[2 * bodies + i] = p.z;
+            }
+        });
+        recordStep(writer, positions.data());
+    }
+    if (!finishRecording(writer))
+    {
+        std::cout << "Failed writing recording " << options.recordPath << std::endl;
+        return -1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t bytes = writer.header.indexOffset + writer.blocks.size() * sizeof(RecordingBlock);
+    std::cout << "Recorded " << steps << " steps of " << bodies << " bodies over days " << options.startDay
+        << " to " << recordingEndDay(writer.header) << " in " << seconds << " s: " << bytes / 1024 << " KB, "
+        << (double)bytes / ((double)steps * bodies) << " bytes per body and step (" << 3 * sizeof(double)
+        << " as doubles)" << std::endl;
+    return 0;
+}
+
+int runGravityBenchmark(const std::vector<int>& sizes, const std::vector<double>& thetas)
+{
+    const size_t sampleSize = 1000;
+    const size_t fullDirectLimit = 20000;
+    std::cout << "N,solver,theta,ms,rel_err_p50,rel_err_p99,nodes" << std::endl;
+
+    for (int count : sizes)
+    {
+        NBodySystem system;
+        buildPlummerSphere(system, count, 42);
+        size_t sample = std::min((size_t)count, sampleSize);
+
+        // Exact reference for the sample, also the direct timing
+        auto start = std::chrono::steady_clock::now();
+        if ((size_t)count <= fullDirectLimit)
+            computeAccelerations(system);
+        else
+            parallelFor(sample, 16, [&](size_t begin, size_t end) { accumulateAccelerations(system, begin, end); });
+        double directMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        bool estimated = (size_t)count > fullDirectLimit;
+        if (estimated)
+            directMs *= (double)count / sample;
+        std::vector<double> refX(system.ax.begin(), system.ax.begin() + sample);
+        std::vector<double> refY(system.ay.begin(), system.ay.begin() + sample);
+        std::vector<double> refZ(system.az.begin(), system.az.begin() + sample);
+        std::cout << count << ",direct" << (estimated ? "_estimated" : "") << ",0," << directMs << ",0,0,0" << std::endl;
+
+        for (double theta : thetas)
+        {
+            system.solver = ForceSolver::BarnesHut;
+            system.theta = theta;
+            computeAccelerations(system); // warm up the arena
+            start = std::chrono::steady_clock::now();
+            computeAccelerations(system);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            std::vector<double> errors(sample);
+            for (size_t i = 0; i < sample; ++i)
+            {
+                double ex = system.ax[i] - refX[i], ey = system.ay[i] - refY[i], ez = system.az[i] - refZ[i];
+                double ref = std::sqrt(refX[i] * refX[i] + refY[i] * refY[i] + refZ[i] * refZ[i]);
+                errors[i] = std::sqrt(ex * ex + ey * ey + ez * ez) / std::max(ref, 1e-300);
+            }
+            std::cout << count << ",barnes_hut," << theta << "," << ms << "," << percentile(errors, 0.5) << ","
+                << percentile(errors, 0.99) << "," << system.tree.nodes.size() << std::endl;
+        }
+    }
+    return 0;
+}
+
+// Benchmark suite
+// Micro benchmarks of the mesh, transform, physics and capture code plus whole headless frames at
+// 10 to 10^6 bodies, printed as CSV with stable names so runs can be compared. Every input is
+// generated from fixed seeds. Each benchmark is calibrated so one sample takes at least
+// BENCH_SAMPLE_SECONDS, then BENCH_SAMPLES samples are taken and the median and minimum per
+// operation are reported.
+const double BENCH_SAMPLE_SECONDS = 0.05;
+const int BENCH_SAMPLES = 5;
+
+#ifdef _WIN32
+const char* NULL_DEVICE = "NUL";
+#else
+const char* NULL_DEVICE = "/dev/null";
+#endif
+
+struct BenchmarkSuite
+{
+    std::string filter;
+    std::vector<std::pair<std::string, double>> baseline; // name, ns per op
+    double tolerance = 0.10;
+    int regressions = 0;
+};
+
+template <typename Body>
+void runBenchmark(BenchmarkSuite& suite, const std::string& name, double itemsPerOp, Body body)
+{
+    if (!suite.filter.empty() && name.find(suite.filter) == std::string::npos)
+        return;
+
+    // Warm up once, then size the samples from that run
+    auto start = std::chrono::steady_clock::now();
+    body();
+    double once = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    long long iterations = std::max(1LL, (long long)(BENCH_SAMPLE_SECONDS / std::max(once, 1e-9)));
+    int samples = once > 1.0 ? 3 : BENCH_SAMPLES;
+
+    std::vector<double> nsPerOp;
+    for (int sample = 0; sample < samples; ++sample)
+    {
+        start = std::chrono::steady_clock::now();
+        for (long long i = 0; i < iterations; ++i)
+            body();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        nsPerOp.push_back(seconds * 1e9 / iterations);
+    }
+    double median = percentile(nsPerOp, 0.5);
+    double fastest = *std::min_element(nsPerOp.begin(), nsPerOp.end());
+
+    std::cout << name << "," << iterations * samples << "," << median << "," << fastest << ","
+        << itemsPerOp * 1e9 / median;
+    for (const auto& entry : suite.baseline)
+    {
+        if (entry.first != name)
+            continue;
+        double ratio = median / entry.second;
+        bool regressed = ratio > 1.0 + suite.tolerance;
+        suite.regressions += regressed ? 1 : 0;
+        std::cout << "," << entry.second << "," << ratio << (regressed ? ",REGRESSED" : ",ok");
+    }
+    std::cout << std::endl;
+}
+
+// Reads name and median columns from an earlier run's CSV
+bool loadBenchmarkBaseline(const std::string& path, BenchmarkSuite& suite)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cout << "Cannot read baseline " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line))
+    {
+        size_t first = line.find(','), second = first == std::string::npos ? first : line.find(',', first + 1);
+        if (second == std::string::npos || line.compare(0, first, "name") == 0)
+            continue;
+        size_t third = line.find(',', second + 1);
+        double ns = std::atof(line.substr(second + 1, third - second - 1).c_str());
+        if (ns > 0.0)
+            suite.baseline.push_back({ line.substr(0, first), ns });
+    }
+    return true;
+}
+
+// Deterministic test image, smooth gradients with some noise so the encoders see realistic runs
+std::vector<unsigned char> benchmarkImage(int width, int height)
+{
+    std::vector<unsigned char> rgba((size_t)width * height * 4);
+    std::mt19937 rng(7);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            unsigned char* p = &rgba[((size_t)y * width + x) * 4];
+            bool noisy = (rng() & 15) == 0;
+            p[0] = (unsigned char)(x * 255 / width);
+            p[1] = (unsigned char)(y * 255 / height);
+            p[2] = noisy ? (unsigned char)rng() : 128;
+            p[3] = 255;
+        }
+    return rgba;
+}
+
+// Encodes an image as QOI and decodes it again, true if every pixel comes back
+bool qoiRoundTrips(const std::vector<unsigned char>& rgba, int width, int height)
+{
+    std::vector<unsigned char> scratch, decoded;
+    size_t size = encodeQOI(rgba.data(), width, height, scratch);
+    int decodedWidth, decodedHeight;
+    if (!decodeQOI(scratch.data(), size, decoded, decodedWidth, decodedHeight) || decodedWidth != width || decodedHeight != height)
+        return false;
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            const unsigned char* in = &rgba[((size_t)(height - 1 - y) * width + x) * 4]; // rows were flipped
+            const unsigned char* out = &decoded[((size_t)y * width + x) * 4];
+            if (in[0] != out[0] || in[1] != out[1] || in[2] != out[2] || out[3] != 255)
+                return false;
+        }
+    return true;
+}
+
+void runCpuBenchmarks(BenchmarkSuite& suite)
+{
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+
+    // Mesh generation
+    const int sphereSizes[3][2] = { { 36, 18 }, { 72, 36 }, { 144, 72 } };
+    for (auto& size : sphereSizes)
+        runBenchmark(suite, "mesh/create_sphere/" + std::to_string(size[0]) + "x" + std::to_string(size[1]),
+            1, [&] { createSphere(10.0f, size[0], size[1], vertices, indices); });
+    for (int level = 0; level < SPHERE_LOD_LEVELS; ++level)
+        runBenchmark(suite, "mesh/create_icosphere/level_" + std::to_string(level), 1,
+            [&] { createIcosphere(1.0f, level, vertices, indices); });
+    runBenchmark(suite, "mesh/generate_octahedron", 1, [&] { generateOctahedronData(1.0f, vertices, indices); });
+    createIcosphere(1.0f, SPHERE_LOD_LEVELS - 1, vertices, indices);
+    runBenchmark(suite, "mesh/register_packed/icosphere_level_5", 1, [&] {
+        MeshPool pool;
+        registerMesh(pool, "sphere", vertices, indices);
+    });
+
+    // Transforms
+    physicsMode = PhysicsMode::Analytic;
+    buildSolarSystemGraph();
+    double day = 0.0;
+    runBenchmark(suite, "transforms/solar_system_analytic", 1, [&] { updateSolarSystemTransforms(day += 0.01); });
+    buildSolarSystemNBody(100000 - 3, Integrator::Leapfrog, 1.0 / 24);
+    physicsMode = PhysicsMode::NBody;
+    glm::vec3 camera(30.0f, 20.0f, 90.0f);
+    Frustum frustum = extractFrustum(glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 1000.0f)
+        * glm::lookAt(camera, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+    registerSceneMeshes();
+    addAsteroidInstances(camera, frustum, glm::radians(45.0f), 1080);
+    runBenchmark(suite, "transforms/asteroid_instances/bodies_100000", 100000, [&] {
+        clearInstances(meshPool);
+        addAsteroidInstances(camera, frustum, glm::radians(45.0f), 1080);
+    });
+    runBenchmark(suite, "cull/spheres/bodies_100000", 100000, [&] {
+        visibleBodies.clear();
+        cullSpheres(asteroidBounds, frustum, visibleBodies);
+    });
+    meshPool = MeshPool();
+
+    // Picking, a belt of a million spheres seen from the default camera
+    {
+        std::mt19937 rng(12345);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        SphereBounds belt;
+        belt.resize(1000000);
+        for (size_t i = 0; i < belt.size(); ++i)
+        {
+            float radius = 60.0f + 30.0f * unit(rng), angle = 6.2831853f * unit(rng);
+            belt.x[i] = radius * cosf(angle);
+            belt.y[i] = 4.0f * (unit(rng) - 0.5f);
+            belt.z[i] = radius * sinf(angle);
+            belt.radius[i] = 0.1f;
+        }
+        SphereBvh bvh;
+        buildBvh(bvh, belt);
+        runBenchmark(suite, "picking/bvh_build/bodies_1000000", 1000000, [&] { buildBvh(bvh, belt); });
+        runBenchmark(suite, "picking/bvh_refit/bodies_1000000", 1000000, [&] { refitBvh(bvh, belt); });
+        glm::mat4 inverse = glm::inverse(glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 1000.0f)
+            * glm::lookAt(camera, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+        size_t ray = 0;
+        runBenchmark(suite, "picking/raycast/bodies_1000000", 1, [&] {
+            // Rays through a fixed 16 x 16 grid of cursor positions in turn
+            float ndcX = (ray % 16) / 7.5f - 1.0f, ndcY = (ray / 16 % 16) / 7.5f - 1.0f;
+            ray++;
+            glm::vec4 nearPoint = inverse * glm::vec4(ndcX, ndcY, -1.0f, 1.0f), farPoint = inverse * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+            glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w, end = glm::vec3(farPoint) / farPoint.w;
+            float nearest = glm::length(end - origin);
+            raycastBvh(bvh, origin, (end - origin) / nearest, nearest);
+        });
+    }
+
+    // Physics
+    buildPlummerSphere(nbody, 1000, 1);
+    runBenchmark(suite, "physics/gravity_direct/bodies_1000", 1000, [&] { nbody.solver = ForceSolver::Direct; computeAccelerations(nbody); });
+    buildPlummerSphere(nbody, 16000, 1);
+    runBenchmark(suite, "physics/gravity_direct/bodies_16000", 16000, [&] { nbody.solver = ForceSolver::Direct; computeAccelerations(nbody); });
+    runBenchmark(suite, "physics/gravity_barnes_hut_0.5/bodies_16000", 16000, [&] {
+        nbody.solver = ForceSolver::BarnesHut;
+        nbody.theta = 0.5;
+        computeAccelerations(nbody);
+    });
+    buildSolarSystemNBody(1000 - 3, Integrator::Leapfrog, 1.0 / 24);
+    runBenchmark(suite, "physics/step_leapfrog/bodies_1000", 1000, [&] { stepNBody(nbody); });
+    nbody.integrator = Integrator::Yoshida4;
+    runBenchmark(suite, "physics/step_yoshida4/bodies_1000", 1000, [&] { stepNBody(nbody); });
+
+    std::string ephemerisPath = "bench_ephemeris.tmp";
+    buildSolarSystemNBody(20, Integrator::Yoshida4, 1.0 / 24);
+    std::streambuf* out = std::cout.rdbuf(nullptr); // keep the bake's report out of the CSV
+    bool baked = bakeEphemeris(ephemerisPath, nbody, nbodyFirstAsteroid, 0.0, 365.0, 8.0, 12);
+    std::cout.rdbuf(out);
+    Ephemeris eph;
+    if (baked && openEphemeris(ephemerisPath, eph))
+    {
+        std::vector<double> x(eph.header->bodyCount), y(x.size()), z(x.size());
+        double t = 0.0;
+        runBenchmark(suite, "physics/ephemeris_evaluate/bodies_23", 23, [&] {
+            t = fmod(t + 3.7, 365.0);
+            evaluateEphemeris(eph, t, x.data(), y.data(), z.data());
+        });
+        closeEphemeris(eph);
+    }
+    std::remove(ephemerisPath.c_str());
+
+    // Recordings: 1024 steps of a Kepler belt, played in order and sought at random
+    std::string recordingPath = "bench_recording.tmp";
+    buildSolarSystemKepler(10000 - 3, BodyCatalog());
+    RecordingWriter writer;
+    size_t recordedBodies = nbody.mass.size();
+    std::vector<double> positions(3 * recordedBodies);
+    bool recorded = beginRecording(writer, recordingPath, nbody.mass, nbodyFirstAsteroid, 0.0, 1.0 / 96, 32);
+    for (int step = 0; recorded && step < 1024; ++step)
+    {
+        propagateKepler(keplerOrbits, step / 96.0, positions.data(), positions.data() + recordedBodies,
+            positions.data() + 2 * recordedBodies);
+        recordStep(writer, positions.data());
+    }
+    Recording rec;
+    if (recorded && finishRecording(writer) && openRecording(recordingPath, rec))
+    {
+        NBodySystem played = nbody;
+        played.px = played.x; played.py = played.y; played.pz = played.z;
+        double playDay = 0.0;
+        runBenchmark(suite, "physics/recording_play/bodies_10000", 10000, [&] {
+            playDay = fmod(playDay + 1.0 / 96, 1023.0 / 96);
+            evaluateRecording(rec, playDay, played);
+        });
+        uint64_t seekStep = 0;
+        runBenchmark(suite, "physics/recording_seek/bodies_10000", 10000, [&] {
+            seekStep = (seekStep * 6364136223846793005ull + 1442695040888963407ull);
+            seekRecording(rec, (seekStep >> 33) % 1024);
+        });
+        closeRecording(rec);
+    }
+    std::remove(recordingPath.c_str());
+
+    buildSolarSystemKepler(1000000 - 3, BodyCatalog());
+    double keplerDay = 0.0;
+    runBenchmark(suite, "physics/kepler_propagate/bodies_1000000", 1000000, [&] {
+        propagateKepler(keplerOrbits, keplerDay += 3.7, nbody.x.data(), nbody.y.data(), nbody.z.data());
+    });
+
+    // Capture encoders on a 1080p frame
+    const int width = 1920, height = 1080;
+    std::vector<unsigned char> image = benchmarkImage(width, height), scratch;
+    // Checked against the reference decoder first, including black hitting an index slot
+    // before anything was written to it
+    const std::vector<unsigned char> indexHits = { 10, 20, 30, 255, 0, 0, 0, 255, 200, 100, 50, 255, 90, 10, 160, 255,
+        200, 100, 50, 255, 0, 0, 0, 255, 10, 20, 30, 255 };
+    if (!qoiRoundTrips(indexHits, 7, 1) || !qoiRoundTrips(image, width, height))
+    {
+        std::cerr << "QOI round trip failed" << std::endl;
+        suite.regressions++;
+    }
+    runBenchmark(suite, "capture/encode_ppm/1920x1080", 1, [&] { writePPM(NULL_DEVICE, image.data(), width, height, scratch); });
+    runBenchmark(suite, "capture/encode_qoi/1920x1080", 1, [&] { writeQOI(NULL_DEVICE, image.data(), width, height, scratch); });
+    int fd = openFrameStream(NULL_DEVICE);
+    bool headerWritten = false;
+    runBenchmark(suite, "capture/stream_y4m/1920x1080", 1, [&] {
+        writeStreamFrame(fd, StreamFormat::Y4M, 30, headerWritten, image.data(), width, height, scratch);
+    });
+    runBenchmark(suite, "capture/stream_rgb/1920x1080", 1, [&] {
+        writeStreamFrame(fd, StreamFormat::RawRGB, 30, headerWritten, image.data(), width, height, scratch);
+    });
+    closeFrameStream(fd);
+}
+
+// The parallel kernels again at 1 to 16 job system threads, restoring the thread count afterwards
+void runScalingBenchmarks(BenchmarkSuite& suite, int threads)
+{
+    NBodySystem cluster;
+    buildPlummerSphere(cluster, 8000, 1);
+    NBodySystem largeCluster;
+    buildPlummerSphere(largeCluster, 64000, 1);
+    largeCluster.solver = ForceSolver::BarnesHut;
+
+    physicsMode = PhysicsMode::NBody;
+    buildSolarSystemNBody(200000 - 3, Integrator::Leapfrog, 1.0 / 24);
+    registerSceneMeshes();
+    glm::vec3 camera(30.0f, 20.0f, 90.0f);
+    Frustum frustum = extractFrustum(glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 1000.0f)
+        * glm::lookAt(camera, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+    std::vector<unsigned char> image = benchmarkImage(1920, 1080), scratch;
+    int fd = openFrameStream(NULL_DEVICE);
+    bool headerWritten = false;
+
+    const int threadCounts[5] = { 1, 2, 4, 8, 16 };
+    for (int count : threadCounts)
+    {
+        startJobSystem(count);
+        std::string suffix = "/threads_" + std::to_string(count);
+        runBenchmark(suite, "scaling/gravity_direct/bodies_8000" + suffix, 8000, [&] { computeAccelerations(cluster); });
+        runBenchmark(suite, "scaling/gravity_barnes_hut_0.5/bodies_64000" + suffix, 64000, [&] { computeAccelerations(largeCluster); });
+        runBenchmark(suite, "scaling/asteroid_instances/bodies_200000" + suffix, 200000, [&] {
+            clearInstances(meshPool);
+            addAsteroidInstances(camera, frustum, glm::radians(45.0f), 1080);
+        });
+        runBenchmark(suite, "scaling/stream_y4m/1920x1080" + suffix, 1, [&] {
+            writeStreamFrame(fd, StreamFormat::Y4M, 30, headerWritten, image.data(), 1920, 1080, scratch);
+        });
+    }
+    closeFrameStream(fd);
+    meshPool = MeshPool();
+    startJobSystem(threads);
+}
+
+#ifdef __linux__
+// Readback and whole frames, offscreen at the --size resolution
+void runGpuBenchmarks(BenchmarkSuite& suite, int width, int height)
+{
+    std::string size = std::to_string(width) + "x" + std::to_string(height);
+    HeadlessContext headless;
+    OffscreenTarget target;
+    if (!createHeadlessContext(headless) || !gladLoadGLLoader((GLADloadproc)eglGetProcAddress) ||
+        !createOffscreenTarget(target, width, height))
+    {
+        std::cerr << "No headless GL context, skipping frame benchmarks" << std::endl;
+        destroyHeadlessContext(headless);
+        return;
+    }
+    loadOptionalGL((GLADloadproc)eglGetProcAddress);
+    std::cerr << "# renderer: " << glGetString(GL_RENDERER) << std::endl;
+    physicsMode = PhysicsMode::Analytic;
+    if (!setupScene())
+    {
+        releaseScene();
+        releaseOffscreenTarget(target);
+        destroyHeadlessContext(headless);
+        return;
+    }
+    cameraPosition = 1;
+    renderScene(0.0, width, height);
+
+    std::string dumpPath = "bench_dump.tmp";
+    runBenchmark(suite, "capture/dump_framebuffer_to_ppm/" + size, 1, [&] { dump_framebuffer_to_ppm(dumpPath, width, height); });
+    std::remove((dumpPath + ".ppm").c_str());
+
+    // The asynchronous pipeline into a stream that goes nowhere, so disks do not skew the numbers
+    FrameCapture capture;
+    capture.writer.streamFd = openFrameStream(NULL_DEVICE);
+    capture.writer.streamFormat = StreamFormat::RawRGB;
+    startFrameCapture(capture, CaptureFormat::PPM);
+    runBenchmark(suite, "capture/async_readback_rgb/" + size, 1, [&] {
+        captureFrame(capture, "bench", width, height);
+        pollFrameCapture(capture);
+    });
+
+    // Whole frames: one physics step, transforms, culling, drawing and capture. Large systems use
+    // leapfrog and Barnes-Hut so a frame stays within seconds.
+    const int bodyCounts[4] = { 10, 1000, 100000, 1000000 };
+    for (int bodies : bodyCounts)
+    {
+        std::string name = "frame/headless_" + size + "/bodies_" + std::to_string(bodies);
+        if (!suite.filter.empty() && name.find(suite.filter) == std::string::npos)
+            continue;
+        physicsMode = PhysicsMode::NBody;
+        buildSolarSystemNBody(bodies - 3, bodies > 10000 ? Integrator::Leapfrog : Integrator::Yoshida4, 1.0 / 24);
+        nbody.solver = bodies > 10000 ? ForceSolver::BarnesHut : ForceSolver::Direct;
+        nbody.theta = 0.7;
+        double day = 0.0;
+        runBenchmark(suite, name, bodies, [&] {
+            day += nbody.dt;
+            renderScene(day, width, height);
+            captureFrame(capture, "bench", width, height);
+            pollFrameCapture(capture);
+        });
+    }
+    finishFrameCapture(capture);
+    closeFrameStream(capture.writer.streamFd);
+
+    releaseScene();
+    releaseOffscreenTarget(target);
+    destroyHeadlessContext(headless);
+}
+#endif
+
+int runBenchmarkSuite(const RenderOptions& options)
+{
+    BenchmarkSuite suite;
+    suite.filter = options.benchFilter;
+    suite.tolerance = options.benchTolerance;
+    if (!options.benchBaseline.empty() && !loadBenchmarkBaseline(options.benchBaseline, suite))
+        return -1;
+
+#if defined(__clang__)
+    std::cerr << "# compiler: clang " << __clang_major__ << "." << __clang_minor__ << "." << __clang_patchlevel__ << std::endl;
+#elif defined(__GNUC__)
+    std::cerr << "# compiler: gcc " << __GNUC__ << "." << __GNUC_MINOR__ << "." << __GNUC_PATCHLEVEL__ << std::endl;
+#elif defined(_MSC_VER)
+    std::cerr << "# compiler: msvc " << _MSC_FULL_VER << std::endl;
+#endif
+#if defined(__AVX512F__)
+    std::cerr << "# simd: avx512" << std::endl;
+#elif defined(__AVX2__)
+    std::cerr << "# simd: avx2" << std::endl;
+#elif defined(__SSE2__) || defined(_M_X64)
+    std::cerr << "# simd: sse2" << std::endl;
+#endif
+    std::cerr << "# threads: " << jobThreadCount() << " of " << std::thread::hardware_concurrency() << std::endl;
+
+    std::cout << "name,iterations,ns_per_op_median,ns_per_op_min,items_per_second";
+    if (!suite.baseline.empty())
+        std::cout << ",baseline_ns_per_op,ratio,status";
+    std::cout << std::endl;
+
+    runCpuBenchmarks(suite);
+    if (suite.filter.empty() || suite.filter.find("scaling") != std::string::npos)
+        runScalingBenchmarks(suite, options.threads);
+#ifdef __linux__
+    runGpuBenchmarks(suite, options.width, options.height);
+#endif
+    if (suite.regressions > 0)
+    {
+        std::cerr << suite.regressions << " benchmark(s) slower than the baseline by more than "
+            << suite.tolerance * 100.0 << "%" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    RenderOptions options;
+    if (!parseCommandLine(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return -1;
+    }
+    startJobSystem(options.threads);
+    shaderManager.cacheDirectory = options.shaderCache;
+    trails.capacity = options.trails;
+    trails.stepDays = options.trailStep;
+    if (!options.scenePath.empty() && !loadScene(options.scenePath, scene, sceneCatalog))
+        return -1;
+    if (!options.saveScenePath.empty())
+        return saveScene(options.saveScenePath, scene, sceneCatalog) ? 0 : -1;
+    if (sceneCatalog.count > 0 && options.physics == PhysicsMode::Analytic)
+    {
+        std::cout << "The scene has a body catalog, switching to N-body physics" << std::endl;
+        options.physics = PhysicsMode::NBody;
+    }
+    if (options.benchSuite)
+        return runBenchmarkSuite(options);
+    if (options.benchGravity)
+        return runGravityBenchmark(options.benchSizes, options.benchThetas);
+    if (!options.bakeEphemerisPath.empty())
+        return runEphemerisBake(options);
+    if (!options.recordPath.empty())
+        return runRecording(options);
+    if (options.meshReport)
+    {
+        // Instances as the default camera sees them on day 0 at the requested size
+        registerSceneMeshes();
+        buildSolarSystemNBody(options.asteroids, options.integrator, options.physicsStep);
+        addCatalogBodies(nbody, sceneCatalog);
+        glm::vec3 camera(30.0f, 20.0f, 90.0f);
+        glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), (float)options.width / options.height, 0.1f, 1000.0f)
+            * glm::lookAt(camera, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        addAsteroidInstances(camera, extractFrustum(viewProjection), glm::radians(45.0f), options.height);
+        meshPool.meshes[octahedronMesh].instances.resize(3);
+        std::vector<size_t> instanceCounts;
+        for (const PooledMesh& mesh : meshPool.meshes)
+            instanceCounts.push_back(mesh.instances.size());
+        printMeshPoolReport(meshPool, instanceCounts);
+        return 0;
+    }
+    if (options.headless)
+        return options.shards > 1 ? runShardedHeadless(options) : runHeadless(options);
+    // Instantiate the GLFW window
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    //glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+
+    // Create window object
+    GLFWwindow* window = glfwCreateWindow(1024, 576, "Assignment 1", NULL, NULL);
+    if (window == NULL)
+    {
+        std::cout << "Failed to create GLFW window" << std::endl;
+        glfwTerminate();
+        return -1;
+    }
+
+    glfwMakeContextCurrent(window);
+    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    glfwSetKeyCallback(window, key_callback);
+    glfwSetMouseButtonCallback(window, mouse_button_callback);
+
+    // Initalize GLAD
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    {
+        std::cout << "Failed to initialize GLAD" << std::endl;
+        return -1;
+    }
+    loadOptionalGL((GLADloadproc)glfwGetProcAddress);
+
+    if (!configureSimulation(options))
+    {
+        glfwTerminate();
+        return -1;
+    }
+    if (!setupScene())
+    {
+        releaseScene();
+        glfwTerminate();
+        return -1;
+    }
+
+    pickingEnabled = true;
+    FrameCapture capture;
+    startFrameCapture(capture, CaptureFormat::PPM);
+    long long capturedFrames = 0;
+    char frameName[32];
+
+    SimulationClock& clock = simulationClock;
+    clock.day = options.startDay;
+    setWarp(clock, options.warp);
+    bool pipelined = physicsMode == PhysicsMode::NBody && options.pipeline;
+    if (pipelined)
+        startSimulationThread(simulationThread, clock.day);
+    auto lastFrame = std::chrono::steady_clock::now();
+    if (!options.profilePrefix.empty())
+        startProfiler();
+    double lastTitleUpdate = 0.0;
+    while (!glfwWindowShouldClose(window))
+    {
+        beginProfileFrame();
+        if (warpChange != 1.0)
+        {
+            setWarp(clock, clock.warp * warpChange);
+            std::cout << "Time warp " << clock.warp << "x" << std::endl;
+            warpChange = 1.0;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        double previousDay = clock.day;
+        tickSimulationClock(clock, std::chrono::duration<double>(now - lastFrame).count());
+        lastFrame = now;
+        // Pipelined, the thread is asked to run one frame's worth of time ahead of the clock
+        if (pipelined)
+            syncPipelinedSimulation(simulationThread, clock, clock.day - previousDay);
+        else
+            syncSimulation(clock, SIMULATION_BUDGET_SECONDS);
+
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        renderScene(clock.day, framebufferWidth, framebufferHeight);
+
+        {
+            ProfileScope captureZone(ZONE_CAPTURE);
+            if (captureRequested)
+            {
+                int buffer_width, buffer_height;
+                glfwGetFramebufferSize(window, &buffer_width, &buffer_height);
+                std::snprintf(frameName, sizeof(frameName), "capture_%06lld", capturedFrames++);
+                captureFrame(capture, frameName, buffer_width, buffer_height);
+            }
+            pollFrameCapture(capture);
+        }
+
+        glfwSwapBuffers(window);
+        glfwPollEvents();
+        endProfileFrame();
+
+        // Rolling frame time percentiles in the title, twice a second
+        if (glfwGetTime() - lastTitleUpdate > 0.5)
+        {
+            lastTitleUpdate = glfwGetTime();
+            glfwSetWindowTitle(window, ("Assignment 1 | " + rollingFrameSummary()).c_str());
+        }
+    }
+
+    stopSimulationThread(simulationThread);
+    finishFrameCapture(capture);
+    printCullStats();
+    finishProfiler(options.profilePrefix);
+    releaseScene();
+    glfwTerminate();
+
+    return 0;
+}